@@ -6,6 +6,13 @@
 #include <memory>
 #include <queue>
 #include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <functional>
+#include <string>
+#include <vector>
+
+class sink_t;
 
 namespace edit
 {
@@ -21,6 +28,200 @@ namespace edit
      */
     constexpr unsigned char DISCONNECT = 0x4;
 
+    /**
+     * @brief A pseudo connection handle, which marks blocks of static commands
+     */
+    constexpr connection_handle_t static_handle = std::numeric_limits<connection_handle_t>::max();
+
+    /**
+     * @brief Formats of file output
+     */
+    enum class file_format_t
+    {
+        per_block,  // one 'bulk<timestamp>_<tid>.log' text file per block
+        block_store // binary block records with a sparse time index, see block_store.h
+    };
+
+    /**
+     * @brief What a sink does with a new block, when its buffer is full
+     */
+    enum class overflow_t
+    {
+        block,       // the producer waits for room: nothing is lost, a slow sink slows the input down
+        drop_oldest, // the oldest buffered block is dropped for the sink
+        spill        // blocks go to a spill file in the log directory and are output from it later, in order
+    };
+
+    /**
+     * @brief Parameters of an output sink
+     */
+    struct sink_options_t
+    {
+        std::size_t workers = 1;                 // nof the sink's output threads; 0 - the sink is off
+        std::size_t limit = 1024;                // max nof blocks buffered for the sink
+        overflow_t overflow = overflow_t::block; // policy when the buffer is full
+    };
+
+    /**
+     * @brief Parameters of fair scheduling of blocks before the sinks: every connection's dynamic blocks
+     *        and the static blocks are separate flows, served by deficit round-robin weighted by bytes
+     */
+    struct fair_options_t
+    {
+        bool enabled = false;             // off - blocks go to the sinks in the order of forming
+        std::size_t quantum = 4096;       // bytes a flow may send per round, multiplied by its weight
+        unsigned static_weight = 1;       // weight of the static blocks' flow
+        unsigned dynamic_weight = 1;      // weight of every connection's flow of dynamic blocks
+        std::size_t flow_limit = 1 << 20; // max bytes of a flow's blocks in memory; its newer blocks are spilled beyond it
+        std::size_t sink_credit = 4;      // max blocks dispatched to a 'block' sink and not yet taken by its threads;
+                                          // the dispatcher waits beyond it, so blocks wait in the flows
+    };
+
+    /**
+     * @brief Parameters of a library instance
+     */
+    struct options_t
+    {
+        std::size_t block_size = 3;                           // nof static cmds in command block
+        const char *log_dir = log_directory;                  // a path to output files
+        file_format_t file_format = file_format_t::per_block; // format of file output
+        std::size_t shards = 0;                               // nof shard threads; 0 - sharded mode is off, see 'set_shards'
+        const char *journal = nullptr;                        // write-ahead journal path; nullptr - no journal, see 'set_journal'
+        unsigned journal_interval_ms = 2;                     // journal commit interval
+        std::size_t journal_bytes = 256 * 1024;               // appended bytes which trigger journal commit before the interval
+        std::size_t journal_compact = 64 << 20;               // journal size, over which its head with output commands is dropped; 0 - never
+        sink_options_t console{1, 1024, overflow_t::spill};   // console sink
+        sink_options_t file{2, 1024, overflow_t::block};      // file sink
+        const char *forward = nullptr;                        // '<ip address>:<port>' of a downstream aggregator; nullptr - no forwarding
+        sink_options_t forwarder{1, 1024, overflow_t::spill}; // TCP forwarder sink
+        unsigned spin_us = 0;                                 // library threads spin so long before sleeping: low-latency mode
+        fair_options_t fair{};                                // fair scheduling of blocks before the sinks
+        std::size_t intern = 0;                               // max entries of the command intern table; 0 - no interning
+        std::size_t intern_max_length = 256;                  // longer commands are not interned
+        std::size_t dynamic_cap = 0;                          // max bytes of a connection's dynamic block in memory; beyond it
+                                                              // the block goes on in a spill file in log_dir; 0 - unlimited
+        std::size_t inline_output = 0;                        // inline output: the thread, which forms blocks, writes them to the sinks
+                                                              // by batches of so many blocks, a partial batch when the thread goes idle;
+                                                              // no output threads, no fair scheduling, sinks' workers and overflow
+                                                              // policies are not used, but by the forwarder; 0 - sinks' own threads
+    };
+
+    /**
+     * @brief Memory accounting of an instance's connections
+     */
+    struct instance_stats_t
+    {
+        std::size_t connections = 0;    // open connections
+        std::size_t contexts = 0;       // allocated input contexts: connections inside a dynamic block
+        std::size_t context_bytes = 0;  // memory of the input contexts, without their buffered commands
+        std::size_t spilled_blocks = 0; // dynamic blocks, which went over options_t::dynamic_cap into spill files
+    };
+
+    /**
+     * @brief Fairness metrics of the output queue, see fair_options_t; counted since the previous query
+     */
+    struct fairness_stats_t
+    {
+        std::size_t flows = 0;           // flows with queued blocks
+        std::size_t queued_blocks = 0;   // blocks waiting for dispatch to the sinks
+        std::size_t queued_bytes = 0;    // their bytes
+        std::size_t dispatched = 0;      // blocks dispatched
+        std::size_t spilled = 0;         // blocks spilled by flows over their flow_limit
+        double jain_index = 1;           // Jain's index of bytes served per busy period of backlogged flows: 1 - equal shares
+        double static_max_wait_us = 0;   // max queueing time of a static block
+        double dynamic_max_wait_us = 0;  // max queueing time of a dynamic block
+        double static_mean_wait_us = 0;  // mean queueing time of static blocks
+        double dynamic_mean_wait_us = 0; // mean queueing time of dynamic blocks
+    };
+
+    /**
+     * @brief Statistics of the command intern table, see options_t::intern
+     */
+    struct intern_stats_t
+    {
+        std::size_t entries = 0;     // interned commands
+        std::size_t bytes = 0;       // their texts' bytes
+        std::uint64_t hits = 0;      // commands, which shared an interned text
+        std::uint64_t misses = 0;    // commands, which were added to the table
+        std::uint64_t evictions = 0; // entries evicted to keep the table bounded
+    };
+
+    /**
+     * @brief A callback, called when a posted operation is accepted by the library
+     */
+    using accept_callback_t = std::function<void()>;
+
+    /**
+     * @brief A callback, called when a posted connection is accepted by the library
+     */
+    using connect_callback_t = std::function<void(connection_handle_t)>;
+
+    struct library_t;
+
+    /**
+     * @brief An independent instance of the library: it has its own block size, log directory,
+     *        connections, static commands buffer, output queue and threads.
+     *        Connection handles are valid within their instance only.
+     *        The functions have the same meaning as the namesake free functions below
+     */
+    class instance_t
+    {
+    private:
+        std::unique_ptr<library_t> lib; // the instance's internals
+
+    public:
+        explicit instance_t(const options_t &options);
+        instance_t(const instance_t &) = delete;
+        instance_t &operator=(const instance_t &) = delete;
+        ~instance_t(); // terminates the instance, if not yet
+
+        connection_handle_t connect();
+        void receive(connection_handle_t ch, const std::string buf);
+        void disconnect(connection_handle_t ch);
+        connection_handle_t post_connect(connect_callback_t on_accepted);
+        void post_receive(connection_handle_t ch, std::vector<std::string> cmds, accept_callback_t on_accepted);
+        void post_disconnect(connection_handle_t ch, accept_callback_t on_accepted);
+        void terminate(); // outputs everything buffered and stops the instance's threads
+        const options_t &options() const;
+        instance_stats_t stats() const;   // open connections and their allocated input contexts
+        fairness_stats_t fairness();      // fairness metrics since the previous call; zeros if fair scheduling is off
+        intern_stats_t interning() const; // command intern table statistics; zeros if interning is off
+        void add_sink(std::unique_ptr<sink_t> sink, const sink_options_t &sink_options); // registers one more output sink;
+                                                                                       // takes effect if called before the first 'connect'
+    };
+
+    /**
+     * @brief The free functions below work with the default instance, created by the first 'connect';
+     *        its block size and log directory are those of the first 'connect'
+     */
+
+    /**
+     * @brief Selects the format of file output; takes effect if called before the first 'connect'
+     * @param format file output format
+     */
+    void set_file_format(file_format_t format);
+
+    /**
+     * @brief Selects sharded execution mode; takes effect if called before the first 'connect'.
+     *        Each of n_shards threads owns connections with handle % n_shards == its number,
+     *        forms their dynamic blocks without locks and publishes them through its own ring.
+     *        The synchronous interface posts operations to shards, as the non-blocking one does
+     * @param n_shards nof shard threads; 0 - sharded mode is off
+     */
+    void set_shards(std::size_t n_shards);
+
+    /**
+     * @brief Enables write-ahead journal; takes effect if called before the first 'connect'.
+     *        Every received command is journaled, and the journal is fsynced by groups of records:
+     *        at most every 'interval_ms' or every 'budget_bytes'. On restart with the same journal,
+     *        the commands of blocks, which were not written by all the sinks, are replayed.
+     *        A clean 'terminate' removes the journal
+     * @param path journal file path; must not be in the log directory, which is rotated
+     * @param interval_ms commit interval
+     * @param budget_bytes appended bytes which trigger commit before the interval
+     */
+    void set_journal(const char *path, unsigned interval_ms = 2, std::size_t budget_bytes = 256 * 1024);
+
     /**
      * @brief Creates new connection to input commands queue
      * @param block_size - nof cmds in command block
@@ -45,6 +246,29 @@ namespace edit
      */
     void disconnect(connection_handle_t ch);
 
+    /**
+     * @brief Non-blocking 'connect': allocates a handle at once and posts the connection
+     *        to the library's ingress queue
+     * @param block_size - nof cmds in command block
+     * @param on_accepted called with the handle when the operation is accepted: at once on the calling thread,
+     *        or later on the library's ingress thread, if the ingress queue is full
+     * @return a handle to the connection, usable in further posted operations
+     */
+    connection_handle_t post_connect(std::size_t block_size, connect_callback_t on_accepted, const char *log_dir = log_directory);
+
+    /**
+     * @brief Non-blocking 'receive' of several commands; see 'post_connect' for 'on_accepted'
+     * @param ch Handle for connection, created by post_connect
+     * @param cmds commands, each is processed as by 'receive'
+     */
+    void post_receive(connection_handle_t ch, std::vector<std::string> cmds, accept_callback_t on_accepted);
+
+    /**
+     * @brief Non-blocking 'disconnect'; see 'post_connect' for 'on_accepted'
+     * @param ch Handle for connection, created by post_connect
+     */
+    void post_disconnect(connection_handle_t ch, accept_callback_t on_accepted);
+
     /**
      * @brief Call 'disconnect' for every connection
      *        and put the rest of static commands buffer into output blocks queue
@@ -0,0 +1,138 @@
+/**
+ * @brief async_asio.h - awaitable (coroutine-native) interface of 'async' library for Asio callers;
+ *        header-only, so that the library itself does not depend on Asio.
+ *        Operations are posted to the library's ingress queue; the calling coroutine
+ *        is resumed on its own executor as soon as the library accepts the operation,
+ *        so it never blocks its io thread on the library's internal locks
+ */
+#pragma once
+#include "async.h"
+#include <boost/asio/associated_executor.hpp>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <memory>
+#include <utility>
+
+namespace edit
+{
+    namespace detail
+    {
+        /**
+         * @brief Makes a library callback, which posts the completion handler to its associated executor;
+         *        the executor is kept busy until then, while the operation may be parked by backpressure
+         * @tparam Args completion arguments
+         * @param handler completion handler
+         */
+        template <typename... Args, typename Handler>
+        std::function<void(Args...)> resume_on_executor(Handler handler)
+        {
+            auto work = boost::asio::make_work_guard(boost::asio::get_associated_executor(handler));
+            auto state = std::make_shared<std::pair<Handler, decltype(work)>>(std::move(handler), std::move(work));
+            return [state](Args... args)
+            {
+                auto ex = state->second.get_executor();
+                boost::asio::post(ex, [state, args...]() mutable
+                                  {
+                                      auto work = std::move(state->second);
+                                      std::move(state->first)(args...);
+                                  });
+            };
+        }
+    }
+
+    /**
+     * @brief Awaitable 'connect'
+     * @param block_size - nof cmds in command block
+     * @param token completion token, 'use_awaitable' by default
+     * @return completes with the connection handle
+     */
+    template <typename CompletionToken = boost::asio::use_awaitable_t<>>
+    auto async_connect(std::size_t block_size, const char *log_dir = log_directory, CompletionToken &&token = {})
+    {
+        return boost::asio::async_initiate<CompletionToken, void(connection_handle_t)>(
+            [block_size, log_dir](auto handler)
+            { post_connect(block_size, detail::resume_on_executor<connection_handle_t>(std::move(handler)), log_dir); },
+            token);
+    }
+
+    /**
+     * @brief Awaitable 'receive' of several commands
+     * @param ch Handle for connection, created by async_connect
+     * @param cmds commands, each is processed as by 'receive'
+     * @param token completion token, 'use_awaitable' by default
+     * @return completes when the commands are accepted by the library
+     */
+    template <typename CompletionToken = boost::asio::use_awaitable_t<>>
+    auto async_receive(connection_handle_t ch, std::vector<std::string> cmds, CompletionToken &&token = {})
+    {
+        return boost::asio::async_initiate<CompletionToken, void()>(
+            [ch](auto handler, std::vector<std::string> cmds)
+            { post_receive(ch, std::move(cmds), detail::resume_on_executor(std::move(handler))); },
+            token, std::move(cmds));
+    }
+
+    /**
+     * @brief Awaitable 'disconnect'
+     * @param ch Handle for connection, created by async_connect
+     * @param token completion token, 'use_awaitable' by default
+     * @return completes when the disconnection is accepted by the library
+     */
+    template <typename CompletionToken = boost::asio::use_awaitable_t<>>
+    auto async_disconnect(connection_handle_t ch, CompletionToken &&token = {})
+    {
+        return boost::asio::async_initiate<CompletionToken, void()>(
+            [ch](auto handler)
+            { post_disconnect(ch, detail::resume_on_executor(std::move(handler))); },
+            token);
+    }
+
+    /**
+     * @brief Awaitable 'connect' to a library instance
+     * @param instance the library instance
+     * @param token completion token, 'use_awaitable' by default
+     * @return completes with the connection handle
+     */
+    template <typename CompletionToken = boost::asio::use_awaitable_t<>>
+    auto async_connect(instance_t &instance, CompletionToken &&token = {})
+    {
+        return boost::asio::async_initiate<CompletionToken, void(connection_handle_t)>(
+            [&instance](auto handler)
+            { instance.post_connect(detail::resume_on_executor<connection_handle_t>(std::move(handler))); },
+            token);
+    }
+
+    /**
+     * @brief Awaitable 'receive' of several commands by a library instance
+     * @param instance the library instance
+     * @param ch Handle for connection, created by async_connect
+     * @param cmds commands, each is processed as by 'receive'
+     * @param token completion token, 'use_awaitable' by default
+     * @return completes when the commands are accepted by the library
+     */
+    template <typename CompletionToken = boost::asio::use_awaitable_t<>>
+    auto async_receive(instance_t &instance, connection_handle_t ch, std::vector<std::string> cmds, CompletionToken &&token = {})
+    {
+        return boost::asio::async_initiate<CompletionToken, void()>(
+            [&instance, ch](auto handler, std::vector<std::string> cmds)
+            { instance.post_receive(ch, std::move(cmds), detail::resume_on_executor(std::move(handler))); },
+            token, std::move(cmds));
+    }
+
+    /**
+     * @brief Awaitable 'disconnect' from a library instance
+     * @param instance the library instance
+     * @param ch Handle for connection, created by async_connect
+     * @param token completion token, 'use_awaitable' by default
+     * @return completes when the disconnection is accepted by the library
+     */
+    template <typename CompletionToken = boost::asio::use_awaitable_t<>>
+    auto async_disconnect(instance_t &instance, connection_handle_t ch, CompletionToken &&token = {})
+    {
+        return boost::asio::async_initiate<CompletionToken, void()>(
+            [&instance, ch](auto handler)
+            { instance.post_disconnect(ch, detail::resume_on_executor(std::move(handler))); },
+            token);
+    }
+}
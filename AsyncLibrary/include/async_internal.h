@@ -4,12 +4,15 @@
 
 #pragma once
 #include "async.h"
+#include "block_spill.h"
+#include "intern.h"
 #include <string>
 #include <vector>
 #include <unordered_map>
 #include <mutex>
 #include <memory>
 #include <thread>
+#include <atomic>
 
 using namespace edit;
 
@@ -33,23 +36,33 @@ enum Lex : unsigned int
 using lexema_t = std::pair<enum Lex, std::string>;
 
 /**
- * @brief Cmds input buffer type (commands are strings)
+ * @brief Cmds input buffer type (commands are inline or shared texts, see intern.h)
  */
-using cmds_t = std::vector<std::string>;
+using cmds_t = std::vector<cmd_t>;
+
+/**
+ * @brief Journal LSNs of commands, parallel to a cmds_t; empty if there is no journal
+ */
+using lsns_t = std::vector<uint64_t>;
 
 /**
  * @brief An input context; provide input block size and realize input queue
  */
 struct input_context_t
 {
-    size_t block_size; // command block size
-    cmds_t dyna_cmds;  // dynamic commands stay here before they form a block
-    int dynamic_depth; // needed to follow using of brackets
+    size_t block_size;                         // command block size
+    cmds_t dyna_cmds;                          // dynamic commands stay here before they form a block
+    lsns_t dyna_lsns;                          // journal LSNs of dynamic commands
+    int dynamic_depth;                         // needed to follow using of brackets
+    size_t dyna_bytes = 0;                     // bytes of the dynamic block's commands
+    std::unique_ptr<block_spill_t> dyna_spill; // the dynamic block's commands over the cap, instead of dyna_cmds
     explicit input_context_t(size_t block_size) : block_size(block_size), dynamic_depth{0} {}
 };
 
 /**
- * @brief A ptr to input context type
+ * @brief A ptr to input context type; nullptr while the connection is out of dynamic blocks:
+ *        a context is allocated by an open bracket and released, when its block is finished,
+ *        so an idle connection costs a map entry only
  */
 using sp_input_context_t = std::shared_ptr<input_context_t>;
 
@@ -60,6 +73,7 @@ struct input_connections_t
 {
     std::mutex mtx;                                                   // A mutex for calling input interface methods from multiple threads
     std::unordered_map<connection_handle_t, sp_input_context_t> ctxs; // connections pool
+    std::atomic<connection_handle_t> next_handle{0};                  // handle for the next connection
     ~input_connections_t()                                            // Thread-safe destructor
     {
         std::lock_guard g(mtx);
@@ -69,9 +83,4 @@ struct input_connections_t
     bool empty();                                   // Thread-safe 'empty' indicator
 };
 
-/**
- * @brief A pool of input connections
- */
-inline input_connections_t input_connections;
-
 lexema_t make_lexema(const std::string buf);
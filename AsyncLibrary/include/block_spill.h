@@ -0,0 +1,47 @@
+/**
+ * @brief block_spill.h - spill files of oversized dynamic blocks for 'async' library.
+ *        When a connection's dynamic block grows over the in-memory cap (options_t::dynamic_cap),
+ *        its commands go on into a spill file; the finished block carries the file instead of commands,
+ *        and the sinks read it back by chunks. The file holds n x (uint32 length + bytes),
+ *        the body of a block store record, so the block store copies it as is.
+ *        The file is unlinked at once: it disappears with its block or the process
+ */
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Size of spill file's write buffer and of chunks read back
+ */
+constexpr size_t block_spill_chunk = 64 * 1024;
+
+/**
+ * @brief Commands of a dynamic block in a spill file; appended by the forming thread,
+ *        then read concurrently by the sinks' threads with positional reads
+ */
+class block_spill_t
+{
+private:
+    int fd = -1;       // the unlinked file
+    uint32_t n = 0;    // nof commands
+    uint64_t size = 0; // bytes written to the file
+    std::string buf;   // appended commands, not yet written
+    void write_out();  // writes buf to the file
+
+public:
+    static std::unique_ptr<block_spill_t> create(const std::string &dir); // creates an unlinked file in dir; nullptr on error
+    block_spill_t(const block_spill_t &) = delete;
+    block_spill_t &operator=(const block_spill_t &) = delete;
+    explicit block_spill_t(int _fd) : fd(_fd) {}
+    ~block_spill_t();
+    void append(std::string_view cmd); // appends a command
+    void finish();                     // writes the rest out; the block is read only after it
+    uint32_t n_cmds() const { return n; }
+    uint64_t bytes() const { return size; } // bytes of the file: commands with their lengths
+    bool read_body(const std::function<bool(std::string_view)> &fn) const; // passes the file by chunks
+    bool read_cmds(const std::function<bool(std::string_view)> &fn) const; // passes the commands one by one
+};
@@ -0,0 +1,145 @@
+/**
+ * @brief block_store.h - binary indexed block store for 'async' library
+ *
+ *        Data file '<log_dir>/blocks_<pid>.bst':
+ *          file header, then length-prefixed block records in append order
+ *        Index file '<log_dir>/blocks_<pid>.bsi':
+ *          sparse index, one entry per chunk of records
+ *        All integers are written in host byte order.
+ */
+#pragma once
+#include "async.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <mutex>
+#include <functional>
+
+struct cmd_block_t;
+
+/**
+ * @brief Magic words which start the data and the index files
+ */
+constexpr char store_magic[8] = {'B', 'L', 'K', 'S', 'T', 'O', 'R', '1'};
+constexpr char index_magic[8] = {'B', 'L', 'K', 'I', 'D', 'X', '0', '1'};
+
+/**
+ * @brief File name extensions of the data and the index files
+ */
+constexpr auto store_ext = ".bst";
+constexpr auto index_ext = ".bsi";
+
+/**
+ * @brief A chunk is closed and indexed when it reaches one of these limits
+ */
+constexpr size_t chunk_max_records = 256;
+constexpr size_t chunk_max_bytes = 64 * 1024;
+
+/**
+ * @brief Data file header; anchors allow to convert monotonic time to wall time
+ */
+struct store_header_t
+{
+    char magic[8];         // store_magic
+    uint64_t wall_ns;      // system_clock at store opening, ns since epoch
+    uint64_t mono_ns;      // steady_clock at store opening, ns
+    uint64_t reserved = 0; // keeps header 8-bytes aligned
+};
+
+/**
+ * @brief Fixed part of a block record; followed by n_cmds x (uint32 len + bytes)
+ */
+struct record_header_t
+{
+    uint32_t length;  // record length, excluding this field
+    uint32_t n_cmds;  // nof commands in block
+    uint64_t handle;  // connection handle or edit::static_handle
+    uint64_t seq;     // block sequence number
+    uint64_t mono_ns; // monotonic timestamp, non-decreasing along the file
+};
+
+/**
+ * @brief Sparse index entry, describes a chunk of records [offset, end)
+ */
+struct index_entry_t
+{
+    uint64_t offset;      // offset of the first record of the chunk
+    uint64_t end;         // offset past the last record of the chunk
+    uint64_t first_ns;    // timestamp of the first record
+    uint64_t last_ns;     // timestamp of the last record
+    uint64_t handle_mask; // bloom mask of connection handles in the chunk
+};
+
+/**
+ * @brief A bit of chunk's handle mask, corresponding to a connection handle
+ */
+inline uint64_t handle_bit(uint64_t handle)
+{
+    return uint64_t(1) << (std::hash<uint64_t>{}(handle) % 64);
+}
+
+/**
+ * @brief Appends block records to the data file and maintains the sparse index
+ */
+class block_store_t
+{
+private:
+    std::mutex mtx;             // serializes appends from several file threads
+    std::ofstream data;         // data file
+    std::ofstream index;        // index file
+    uint64_t offset = 0;        // current end of data file
+    uint64_t last_ns = 0;       // timestamp of the last appended record
+    index_entry_t chunk{};      // currently open chunk
+    size_t chunk_records = 0;   // nof records in the open chunk
+    std::string record;         // reusable record serialization buffer
+    void close_chunk();         // writes the open chunk into index
+
+public:
+    bool open(const std::string &log_dir); // creates data and index files
+    void append(const cmd_block_t &block); // serializes a block as a record
+    void close();                          // closes the open chunk and flushes files
+    ~block_store_t() { close(); }
+};
+
+/**
+ * @brief A block record read back from the store
+ */
+struct stored_block_t
+{
+    uint64_t handle;
+    uint64_t seq;
+    uint64_t mono_ns;
+    std::vector<std::string> cmds;
+};
+
+/**
+ * @brief Query parameters; timestamps are monotonic, as stored
+ */
+struct store_query_t
+{
+    uint64_t from_ns = 0;
+    uint64_t to_ns = UINT64_MAX;
+    bool by_handle = false;
+    uint64_t handle = 0;
+};
+
+/**
+ * @brief Reads a store; answers queries by binary search over its sparse index
+ */
+class block_store_reader_t
+{
+private:
+    std::ifstream data;                 // data file
+    std::vector<index_entry_t> entries; // whole sparse index, it is small
+    uint64_t data_size = 0;             // data file size
+    bool read_record(stored_block_t &block, uint64_t &pos);
+    void scan(uint64_t pos, uint64_t end, const store_query_t &q,
+              const std::function<void(const stored_block_t &)> &out);
+
+public:
+    store_header_t header{};
+    bool open(const std::string &store_path); // opens data file and loads its index
+    size_t query(const store_query_t &q,
+                 const std::function<void(const stored_block_t &)> &out); // returns nof blocks found
+};
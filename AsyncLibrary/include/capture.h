@@ -0,0 +1,89 @@
+/**
+ * @brief capture.h - capture of producers' traffic for offline replay, see bulk_replay
+ *
+ *        Capture file: file header, then records
+ *          varint   time delta from the previous record, ns
+ *          varint   connection handle
+ *          byte     capture_record_t::type_t
+ *          Data:    varint length + raw bytes of the connection's stream
+ *        Varints are unsigned LEB128; the header is written in host byte order.
+ *        Every connection is a byte stream: \n - delimited commands, up to DISCONNECT symbol.
+ *        A truncated record ends the capture.
+ */
+#pragma once
+#include "async.h"
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+/**
+ * @brief Magic word which starts a capture file
+ */
+constexpr char capture_magic[8] = {'B', 'U', 'L', 'K', 'C', 'A', 'P', '1'};
+
+/**
+ * @brief Capture file header; anchors the records' relative time to wall time
+ */
+struct capture_header_t
+{
+    char magic[8];       // capture_magic
+    uint64_t wall_ns;    // system_clock at capture start, ns since epoch
+    uint64_t block_size; // block size of the captured instance, the replay's default
+};
+
+/**
+ * @brief A capture record
+ */
+struct capture_record_t
+{
+    enum type_t : uint8_t
+    {
+        Connect = 1, // a connection is established
+        Data,        // bytes read from the connection
+        Disconnect   // the connection is closed
+    };
+    uint64_t time_ns;                 // since capture start
+    edit::connection_handle_t handle; // connection handle of the captured run
+    type_t type;                      // record type
+    std::string data;                 // Data: the bytes
+};
+
+/**
+ * @brief Writes a capture; records are buffered and written by chunks. Thread safe
+ */
+class capture_writer_t
+{
+private:
+    std::mutex mtx;       // serializes writers
+    std::ofstream file;   // capture file
+    std::string buf;      // records not yet written
+    uint64_t start_ns;    // steady_clock at capture start
+    uint64_t last_ns = 0; // time of the previous record, since capture start
+    void put(capture_record_t::type_t type, edit::connection_handle_t handle, std::string_view data); // mtx is held
+
+public:
+    bool open(const std::string &path, size_t block_size);               // creates the capture, writes the header
+    void connect(edit::connection_handle_t handle);                      // records a new connection
+    void data(edit::connection_handle_t handle, std::string_view bytes); // records bytes read from a connection
+    void disconnect(edit::connection_handle_t handle);                   // records a closed connection
+    void close();                                                        // writes the rest of records
+    ~capture_writer_t() { close(); }
+};
+
+/**
+ * @brief Reads a capture record by record
+ */
+class capture_reader_t
+{
+private:
+    std::ifstream file;   // capture file
+    uint64_t last_ns = 0; // time of the previous record
+    bool get_varint(uint64_t &value);
+
+public:
+    capture_header_t header{};
+    bool open(const std::string &path);  // opens the capture, checks the header
+    bool next(capture_record_t &record); // reads the next record; false at the end
+};
@@ -4,35 +4,24 @@
  */
 #pragma once
 #include "async_internal.h"
+#include "block_store.h"
+#include "fair_queue.h"
+#include "journal.h"
+#include "sink.h"
 #include <string>
 #include <mutex>
-#include <shared_mutex>
 #include <thread>
-#include <condition_variable>
-#include <list>
 #include <atomic>
-#include <type_traits>
+#include <ostream>
+#include <vector>
 #include <memory>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string_view>
 
-constexpr unsigned int NOFLAGS = 0x00000000;
 struct output_context_t;
 
-/**
- * @brief Realizes flag "to file" for template functions
- */
-struct TO_FILE
-{
-    const static unsigned int value = 0xFFFF0000;
-};
-
-/**
- * @brief Realizes flag "to console" for template functions
- */
-struct TO_CONS
-{
-    const static unsigned int value = 0x0000FFFF;
-};
-
 /**
  * @brief A value to initialize timestamp of a command block
  */
@@ -44,77 +33,74 @@ constexpr unsigned int EMPTY_TIME = 0;
 struct cmd_block_t
 {
 
-    clock_t timestamp = EMPTY_TIME;         // time stamp for naming a file
-    std::atomic<unsigned int> output_state; // one of flags: TO_FILE, TO_CONS or NOFLAGS
-    cmds_t cmds;                            // Commands collection
-
-    cmd_block_t() : timestamp(EMPTY_TIME) { output_state.store(NOFLAGS); }
-
-    cmd_block_t(cmd_block_t &other) : timestamp(other.timestamp)
-    {
-        output_state.store(other.output_state.load());
-
-        for (auto c : other.cmds)
-            cmds.emplace_back(c);
-    }
+    clock_t timestamp = EMPTY_TIME;                 // time stamp for naming a file
+    connection_handle_t handle;                     // connection the block came from, or static_handle
+    uint64_t seq;                                   // block sequence number in output queue
+    uint64_t mono_ns;                               // monotonic time of block forming
+    cmds_t cmds;                                    // Commands collection
+    lsns_t lsns;                                    // journal LSNs of the commands
+    std::unique_ptr<block_spill_t> spill;           // commands of an oversized dynamic block instead of cmds, see block_spill.h
+    std::shared_ptr<journal_countdown_t> countdown; // sinks still to write a journaled block; nullptr - not journaled
 
-    cmd_block_t(cmd_block_t &&other) : timestamp(other.timestamp)
-    {
-        output_state.store(other.output_state.load());
+    cmd_block_t() : timestamp(EMPTY_TIME), handle(static_handle), seq(0), mono_ns(0) {}
 
-        for (auto c : other.cmds)
-            cmds.emplace_back(c);
-    }
+    cmd_block_t(cmds_t &&_cmds, lsns_t &&_lsns, connection_handle_t _handle, uint64_t _seq,
+                std::unique_ptr<block_spill_t> _spill = nullptr)
+        : timestamp(clock()), handle(_handle), seq(_seq), mono_ns(mono_now_ns()), cmds(std::move(_cmds)), lsns(std::move(_lsns)),
+          spill(std::move(_spill)) {}
 
-    cmd_block_t(const cmds_t _cmds) : timestamp(clock())
+    static uint64_t mono_now_ns() // monotonic clock in ns
     {
-        output_state.store(NOFLAGS);
-        for (auto c : _cmds)
-            cmds.emplace_back(c);
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
     }
 };
 
 /**
- * @brief Thread worker function to output command blocks to console
+ * @brief Writes a block of cmd's to a stream as a 'block: ...' line
  */
-void thread_to_console();
+void write_block_to_stream(const cmd_block_t &block, std::ostream &stream);
 
 /**
- * @brief Thread worker function to output command blocks to file
+ * @brief Formats a spilled block as a 'block: ...' line by pieces of about block_spill_chunk
+ * @return false if out stopped the output
  */
-void thread_to_file();
+bool format_spilled_block(const cmd_block_t &block, const std::function<bool(std::string_view)> &out);
 
 /**
- * @brief Output cmd blocks queue
+ * @brief Output cmd blocks queue: fans every block out to the queues of all the sinks;
+ *        each sink outputs and releases blocks at its own pace.
+ *        With fair scheduling, blocks pass through the fair queue first and are fanned out in its order.
+ *        In inline output mode (options_t::inline_output), the thread, which forms a block,
+ *        writes it to the sinks itself, by small batches: no context switches, no output threads.
+ *        A remote sink (the forwarder) keeps its own threads, so an unreachable peer does not hold the input
  */
 class cmd_blocks_q_t
 {
 private:
-    std::list<cmd_block_t> lst;     // the output queue of blocks
-    std::shared_mutex common_mtx;   // mutex used to obtain ownership of whole q for read or write
-    std::mutex file_mtx;            // mutex used to allow only one 'file' thread to read queue at the same time
-    std::condition_variable_any cv; // common_mtx-based condition variable for pop from q
+    std::mutex mtx;                                    // keeps the order of blocks equal for all the sinks
+    uint64_t next_seq = 0;                             // sequence number for the next fanned out block, guarded by mtx
+    std::vector<std::unique_ptr<sink_runner_t>> sinks; // the sinks with their queues and threads
+    journal_t &journal;                                // journals written blocks as done
+    std::chrono::microseconds spin;                    // sinks' threads spin so long before sleeping
+    std::unique_ptr<fair_q_t> fair;                    // fair scheduling of blocks; nullptr - off
+    size_t inline_batch;                               // inline output: blocks per batch, written by the pushing thread; 0 - off
+    void fan_out(std::unique_ptr<cmd_block_t> block);  // pushes a block to every sink
+    void pace(size_t credit);                          // fair queue: waits for every sink's credit
 
 public:
-    void erase_push(cmds_t &block); // pushes a block into output queue and erases the blocks which had been written to both file and console
-
-    template <typename T>
-    bool fetch_blocks(std::vector<cmd_block_t> &blocks); // copy ready-to-be-written blocks for output them and establishes
-                                                         // their output state in queue
-    bool empty() { return lst.empty(); }                 // Incapsulation-only queue's emty func
-};
-
-/**
- * @brief Output threadpool
- */
-struct out_threadpool_t
-{
-    std::vector<std::thread> pool;                 // the pool of output threads: one console thread and two file threads
-    std::mutex mtx;                                // Output pool mutex, helps to lazy start output threads
-    bool threads_started;                          // The flag helps to lazy start output threads with first 'connect' call
-    const char *log_dir = nullptr;                 // A path to output files
-    out_threadpool_t() : threads_started(false) {} // constructor
-    void try_to_launch(const char *log_dir);       // The output threads lazy-start function
+    cmd_blocks_q_t(journal_t &_journal, std::chrono::microseconds _spin, const fair_options_t &fair_options,
+                   const std::string &spill_dir, size_t _inline_batch = 0);
+    void push(cmds_t &cmds, lsns_t &lsns, connection_handle_t handle,
+              std::unique_ptr<block_spill_t> spill = nullptr);         // pushes a block to every sink, clears cmds and lsns
+    void push(input_context_t &ctx, connection_handle_t handle);       // pushes a connection's dynamic block, clears it
+    void add(std::unique_ptr<sink_t> sink, const sink_options_t &options,
+             const std::string &spill_dir);                            // registers a sink; before 'launch' only
+    void launch();                                                     // opens the sinks and launches their threads
+    void flush_inline();                                               // inline output: writes the sinks' partial batches
+    void stop();                                                       // outputs the rest of blocks and joins sink threads
+    fairness_stats_t fairness();                                       // fairness metrics since the previous call
 };
 
 /**
@@ -122,43 +108,27 @@ struct out_threadpool_t
  */
 struct static_cmds_buf_t
 {
-    std::mutex mtx;                                                    // buffer access mutex
-    cmds_t cmds;                                                       // queue of cmds, static commands stay here before forming a block in the output queue
-    size_t block_size;                                                 // common block size for all the connections
-    static_cmds_buf_t(size_t _block_size) : block_size(_block_size) {} // constructor
-    void save_static_cmd(const std::string buf);                       // put a command into static buffer;
-                                                                       // if there are already block_size commands there  - then output to blocks queue
+    std::mutex mtx;           // buffer access mutex
+    cmds_t cmds;              // queue of cmds, static commands stay here before forming a block in the output queue
+    lsns_t lsns;              // journal LSNs of the cmds
+    size_t block_size;        // common block size for all the connections
+    cmd_blocks_q_t &blocks_q; // the queue, where formed blocks go
+    static_cmds_buf_t(size_t _block_size, cmd_blocks_q_t &_blocks_q)
+        : block_size(_block_size), blocks_q(_blocks_q) {} // constructor
+    void save_static_cmd(cmd_t cmd, uint64_t lsn); // put a command into static buffer;
+                                                   // if there are already block_size commands there  - then output to blocks queue
 };
 
 /**
- * @brief The type to aggregate all output objects
+ * @brief The type to aggregate all output objects of a library instance
  */
 struct output_context_t
 {
 
-    struct out_threadpool_t th_pool; // output threadpool
-    static_cmds_buf_t static_cmds;   // buffer for input static cmds, common for all the connections
-    cmd_blocks_q_t blocks_q;         // output cmd_blocks FIFO queue
-    output_context_t(size_t _block_size) : static_cmds(_block_size) {}
-};
-
-/**
- * @brief An enveloppe for output_context_t to lazy-allocate it
- *
- */
-struct output_ctxt
-{
-    output_context_t *ptr{nullptr};                     // pointer to lazy-allocate output_context_t
-    output_context_t *operator()(size_t block_size = 0) // functor giving access to output_context_t*,
-    {
-        if (!ptr)
-            ptr = new output_context_t(block_size);
-        return ptr;
-    }
-    ~output_ctxt() { delete ptr; }
+    cmd_blocks_q_t blocks_q;       // fans formed blocks out to the sinks
+    static_cmds_buf_t static_cmds; // buffer for input static cmds, common for all the connections
+    std::once_flag launched;       // sinks are launched with the first 'connect'; in inline output mode, remote sinks' threads only
+    output_context_t(const options_t &options, journal_t &journal);
+    void try_to_launch(); // lazy launch of sinks' threads
+    void stop();          // outputs the rest of blocks and joins sink threads
 };
-
-/**
- * @brief a global storage for output context
- */
-inline output_ctxt output_context;
@@ -0,0 +1,107 @@
+/**
+ * @brief fair_queue.h - fair scheduling of formed blocks before the sinks for 'async' library.
+ *        Every connection's dynamic blocks and the static blocks are separate flows with their own
+ *        sub-queues; a dispatcher thread serves them by deficit round-robin, weighted by bytes,
+ *        so a connection pushing huge transactions does not put small producers' blocks behind it.
+ *        The sinks see blocks in the dispatch order. The dispatcher paces itself by the sinks' credit,
+ *        so the blocks wait in the flows, not in the sinks' buffers. Producers never wait:
+ *        a flow over its memory limit spills its newer blocks to its own spill file
+ */
+#pragma once
+#include "async_internal.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+struct cmd_block_t;
+
+/**
+ * @brief A function, which hands a dispatched block over to the sinks
+ */
+using dispatch_fn_t = std::function<void(std::unique_ptr<cmd_block_t>)>;
+
+/**
+ * @brief A function, which waits until the sinks have credit for more blocks
+ */
+using pace_fn_t = std::function<void()>;
+
+/**
+ * @brief Deficit round-robin queue of blocks with a flow per connection
+ */
+class fair_q_t
+{
+private:
+    /**
+     * @brief A queued block
+     */
+    struct queued_t
+    {
+        std::unique_ptr<cmd_block_t> block; // the block; nullptr - the next one in the flow's spill file
+        size_t bytes;                       // its commands' bytes
+        size_t memory;                      // its bytes in memory: 0 for a spilled block
+        uint64_t queued_ns;                 // monotonic time of queueing
+    };
+
+    /**
+     * @brief A flow: the blocks of a connection or the static blocks
+     */
+    struct flow_t
+    {
+        std::deque<queued_t> q;              // queued blocks
+        size_t memory_bytes = 0;             // bytes of queued blocks in memory
+        size_t deficit = 0;                  // bytes the flow may send in the current round
+        size_t served_bytes = 0;             // statistics: bytes dispatched in the busy period, since the last stats
+        bool backlogged = false;             // statistics: the flow had blocks left after its turn: it wants more than its share
+        std::unique_ptr<std::fstream> spill; // blocks over flow_limit, in order; opened on first overflow and unlinked
+        uint64_t spill_read = 0;             // read position in spill file
+        size_t spilled = 0;                  // nof blocks in spill file
+    };
+
+    fair_options_t options;                                // quantum, weights, flow limit
+    dispatch_fn_t dispatch;                                // hands blocks over to the sinks
+    pace_fn_t pace;                                        // waits for the sinks' credit
+    std::string spill_dir;                                 // directory for spill files of blocks over flow_limit
+    std::mutex mtx;                                        // guards flows and statistics
+    std::condition_variable ready_cv;                      // wakes the dispatcher up
+    std::unordered_map<connection_handle_t, flow_t> flows; // flows with queued blocks
+    std::deque<connection_handle_t> active;                // round-robin order of the flows
+    size_t queued_blocks = 0;                              // statistics: blocks in all the flows
+    size_t queued_bytes = 0;                               // statistics: bytes in all the flows
+    uint64_t dispatched = 0;                               // statistics: blocks dispatched
+    uint64_t spilled = 0;                                  // statistics: blocks spilled by flows over flow_limit
+    uint64_t max_wait_ns[2] = {};                          // statistics: max queueing time of static and dynamic blocks
+    uint64_t sum_wait_ns[2] = {};                          // statistics: total queueing time of static and dynamic blocks
+    uint64_t n_waits[2] = {};                              // statistics: dispatched static and dynamic blocks
+    uint64_t n_periods = 0;                                // statistics: finished busy periods of backlogged flows
+    double sum_served = 0;                                 // statistics: bytes served in the periods
+    double sum_served_sq = 0;                              // statistics: sum of squares of bytes served per period
+    bool stopping = false;                                 // the dispatcher exits when the flows are empty
+    std::chrono::microseconds spin;                        // the dispatcher spins so long before sleeping
+    std::thread dispatcher;                                // the dispatcher thread
+    void run();                                            // the dispatcher thread function
+    bool spill_block(connection_handle_t ch, flow_t &flow,
+                     const cmd_block_t &block);            // appends a block to the flow's spill file, mtx is held
+    std::unique_ptr<cmd_block_t> unspill_block(flow_t &flow); // reads the flow's oldest spilled block, mtx is held
+    size_t quantum_of(connection_handle_t ch) const        // bytes added to a flow's deficit per round
+    {
+        return options.quantum * (ch == static_handle ? options.static_weight : options.dynamic_weight);
+    }
+
+public:
+    fair_q_t(const fair_options_t &_options, dispatch_fn_t _dispatch, pace_fn_t _pace, const std::string &_spill_dir,
+             std::chrono::microseconds _spin)
+        : options(_options), dispatch(std::move(_dispatch)), pace(std::move(_pace)), spill_dir(_spill_dir), spin(_spin) {}
+    ~fair_q_t() { stop(); }
+    void push(std::unique_ptr<cmd_block_t> block); // queues a block into its flow, spilled if the flow is over its limit
+    void launch();                                 // launches the dispatcher
+    void stop();                                   // dispatches the rest of blocks and joins the dispatcher
+    fairness_stats_t stats();                      // fairness metrics since the previous call
+};
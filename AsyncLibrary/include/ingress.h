@@ -0,0 +1,80 @@
+/**
+ * @brief ingress.h - non-blocking ingress queue of 'async' library;
+ *        posted operations are applied by a dedicated ingress thread,
+ *        so callers never wait for the library's internal locks.
+ *        The queue is bounded: synchronous callers wait for room, asynchronous ones are parked
+ *        and never wait; they are bounded by awaiting acceptance, one operation per session
+ */
+#pragma once
+#include "async_internal.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Max nof commands accepted into ingress queue and not yet applied;
+ *        beyond it posted operations are parked until there is room
+ */
+constexpr size_t ingress_capacity = 64 * 1024;
+
+/**
+ * @brief An operation on a connection, posted into ingress queue
+ */
+struct ingress_op_t
+{
+    enum kind_t
+    {
+        Connect,
+        Receive,
+        Disconnect
+    } kind;
+    connection_handle_t handle;
+    std::vector<std::string> cmds{}; // for Receive
+    accept_callback_t on_accepted;   // called once the operation is accepted into queue
+    size_t weight() const { return cmds.size() + 1; }
+};
+
+/**
+ * @brief A function applying operations on the ingress thread
+ */
+using apply_op_t = std::function<void(ingress_op_t &)>;
+
+/**
+ * @brief A function called on the ingress thread, when the queue runs empty
+ */
+using idle_fn_t = std::function<void()>;
+
+/**
+ * @brief Ingress queue: a short-locked FIFO of operations with backpressure
+ */
+class ingress_q_t
+{
+private:
+    std::mutex mtx;                  // guards the queue only, never held while applying operations
+    std::condition_variable cv;      // wakes the ingress thread up
+    std::condition_variable idle_cv; // wakes 'flush' callers up
+    std::condition_variable room_cv; // wakes posting callers, waiting for room
+    std::vector<ingress_op_t> ops;   // accepted operations
+    std::deque<ingress_op_t> parked; // operations waiting for room, in posting order
+    size_t accepted_weight = 0;      // weight of accepted, not yet applied operations
+    bool busy = false;               // the ingress thread is applying a batch
+    bool started = false;            // the ingress thread is launched
+    bool stopping = false;           // the ingress thread exits when there is nothing to apply
+    apply_op_t apply;                // applies an operation on the ingress thread
+    idle_fn_t idle;                  // called when the applied batch leaves the queue empty, or nullptr
+    std::chrono::microseconds spin;  // the ingress thread spins so long before sleeping
+    std::thread worker;              // the ingress thread
+    void run();                      // the ingress thread function
+
+public:
+    explicit ingress_q_t(apply_op_t _apply, std::chrono::microseconds _spin = {}, idle_fn_t _idle = nullptr)
+        : apply(std::move(_apply)), idle(std::move(_idle)), spin(_spin) {}
+    ~ingress_q_t() { stop(); }
+    void post(ingress_op_t op); // accepts an operation or parks it; waits for room only without on_accepted
+    void flush();               // waits until all posted operations are applied
+    void stop();                // applies posted operations and joins the ingress thread
+};
@@ -0,0 +1,44 @@
+/**
+ * @brief instance.h - internals of an independent 'async' library instance
+ */
+#pragma once
+#include "async_internal.h"
+#include "cmd_output.h"
+#include "ingress.h"
+#include "journal.h"
+#include "shards.h"
+#include <string>
+
+/**
+ * @brief All the state of a library instance; the members are declared in the order
+ *        the stages feed each other, so that an earlier stage outlives its consumers
+ */
+struct edit::library_t
+{
+    options_t options;                     // instance parameters
+    journal_t journal;                     // write-ahead journal, if enabled
+    intern_table_t intern;                 // command intern table, if enabled
+    input_connections_t input_connections; // pool of connections, unsharded mode
+    output_context_t output;               // static cmds buffer, output queue, output threads
+    shards_t shards;                       // shard threads, sharded mode
+    ingress_q_t ingress;                   // ingress queue for posted operations, unsharded mode
+    std::mutex terminate_mtx;              // serializes 'terminate' calls
+    bool terminated = false;               // 'terminate' is done, guarded by terminate_mtx
+    std::atomic<size_t> n_connections{0};  // statistics: open connections
+    std::atomic<size_t> n_contexts{0};     // statistics: allocated input contexts
+    std::atomic<size_t> n_spilled{0};      // statistics: dynamic blocks spilled over options.dynamic_cap
+
+    explicit library_t(const options_t &_options);
+    void open_connection(connection_handle_t handle);                          // adds a connection to the pool
+    bool process_cmd(input_context_t &ctx, const std::string &buf, uint64_t lsn); // applies a command to an input context
+    bool process_cmd(sp_input_context_t &ctx, const std::string &buf, uint64_t lsn); // the same, allocating the context on demand
+    void release_context(sp_input_context_t &ctx);                             // frees a context of an idle connection
+    void add_dynamic_cmd(input_context_t &ctx, const std::string &cmd);        // puts a command into a dynamic block, spilling over the cap
+    uint64_t journal_cmd(connection_handle_t ch, const std::string &buf);      // journals a command, if journal is enabled
+    void apply(ingress_op_t &op);                                              // applies a posted operation, unsharded mode
+    ingress_q_t &ingress_for(connection_handle_t ch);                          // the ingress queue for a connection
+    void receive(connection_handle_t ch, const std::string &buf);             // synchronous 'receive', unsharded mode
+    void disconnect(connection_handle_t ch);                                   // synchronous 'disconnect', unsharded mode
+    void flush();                                                              // applies posted operations
+    void terminate();
+};
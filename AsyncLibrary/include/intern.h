@@ -0,0 +1,146 @@
+/**
+ * @brief intern.h - commands of 'async' library blocks and their interning:
+ *        a command is 16 bytes, short texts are kept inline, longer ones in a shared reference-counted node.
+ *        With interning, equal commands share one node from a bounded concurrent table,
+ *        so a queued block costs 16 bytes per command, and a repeated command is not copied
+ */
+#pragma once
+#include "async.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/**
+ * @brief Reference-counted immutable text of a command; the chars follow the header
+ */
+struct cmd_text_t
+{
+    std::atomic<uint32_t> refs; // owners: commands and the intern table
+    uint32_t size;              // text length
+
+    const char *data() const { return reinterpret_cast<const char *>(this + 1); }
+    std::string_view view() const { return {data(), size}; }
+    static cmd_text_t *make(std::string_view text, uint32_t refs) // allocates a node with the text
+    {
+        auto node = new (::operator new(sizeof(cmd_text_t) + text.size())) cmd_text_t{{refs}, uint32_t(text.size())};
+        std::memcpy(reinterpret_cast<char *>(node + 1), text.data(), text.size());
+        return node;
+    }
+    void add_ref() { refs.fetch_add(1, std::memory_order_relaxed); }
+    void release()
+    {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            this->~cmd_text_t();
+            ::operator delete(this);
+        }
+    }
+};
+
+/**
+ * @brief A command of a block: up to 15 chars inline, a longer text in a shared node
+ */
+class cmd_t
+{
+private:
+    static constexpr uint8_t shared_tag = 0xff; // the last byte of a shared command
+    alignas(8) char buf[16];                    // inline chars with their length in the last byte, or a node pointer
+
+    cmd_text_t *node() const
+    {
+        cmd_text_t *p;
+        std::memcpy(&p, buf, sizeof(p));
+        return p;
+    }
+    void set_node(cmd_text_t *p)
+    {
+        std::memcpy(buf, &p, sizeof(p));
+        buf[15] = char(shared_tag);
+    }
+
+public:
+    static constexpr size_t inline_size = 15; // longer texts go to a node
+
+    cmd_t() { buf[15] = 0; }
+    explicit cmd_t(std::string_view text) // a command with its own text
+    {
+        if (text.size() <= inline_size)
+        {
+            std::memcpy(buf, text.data(), text.size());
+            buf[15] = char(text.size());
+        }
+        else
+            set_node(cmd_text_t::make(text, 1));
+    }
+    explicit cmd_t(cmd_text_t *adopted) { set_node(adopted); } // takes over a reference to a node
+    cmd_t(const cmd_t &other)
+    {
+        std::memcpy(buf, other.buf, sizeof(buf));
+        if (shared())
+            node()->add_ref();
+    }
+    cmd_t(cmd_t &&other) noexcept
+    {
+        std::memcpy(buf, other.buf, sizeof(buf));
+        other.buf[15] = 0;
+    }
+    cmd_t &operator=(cmd_t other) noexcept
+    {
+        std::swap(buf, other.buf);
+        return *this;
+    }
+    ~cmd_t()
+    {
+        if (shared())
+            node()->release();
+    }
+
+    bool shared() const { return uint8_t(buf[15]) == shared_tag; }
+    std::string_view view() const { return shared() ? node()->view() : std::string_view(buf, uint8_t(buf[15])); }
+    operator std::string_view() const { return view(); }
+    size_t size() const { return view().size(); }
+};
+
+/**
+ * @brief Bounded concurrent intern table: lock-striped shards of text -> node,
+ *        each evicting by CLOCK (second chance) beyond its part of the capacity.
+ *        An evicted node lives on in the commands, which refer to it
+ */
+class intern_table_t
+{
+private:
+    static constexpr size_t n_shards = 16;
+    struct entry_t
+    {
+        cmd_text_t *node; // the table's reference
+        bool hit;         // looked up since the clock hand passed
+    };
+    struct shard_t
+    {
+        std::mutex mtx;                                    // guards the shard
+        std::unordered_map<std::string_view, entry_t> map; // keys are the nodes' texts
+        std::deque<cmd_text_t *> clock;                    // the clock: nodes in the order of insertion or second chance
+        size_t bytes = 0;                                  // statistics: texts' bytes
+    };
+    std::unique_ptr<shard_t[]> shards;    // the shards; nullptr - interning is off
+    size_t shard_capacity = 0;            // max entries per shard
+    size_t max_length = 0;                // longer commands are not interned
+    std::atomic<uint64_t> n_hits{0};      // statistics: commands found in the table
+    std::atomic<uint64_t> n_misses{0};    // statistics: commands added to the table
+    std::atomic<uint64_t> n_evictions{0}; // statistics: entries evicted
+    void evict(shard_t &shard);           // evicts an entry by CLOCK, mtx is held
+
+public:
+    intern_table_t(size_t capacity, size_t _max_length);
+    ~intern_table_t();
+    cmd_t intern(std::string_view text); // a command for the text, sharing the table's node if possible
+    edit::intern_stats_t stats() const;  // statistics
+};
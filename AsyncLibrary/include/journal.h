@@ -0,0 +1,130 @@
+/**
+ * @brief journal.h - write-ahead journal of 'async' library with group commit
+ *
+ *        Every received command is appended to the journal before it is processed;
+ *        a block, written by all the sinks, is marked done by a record
+ *        listing its commands (brackets of a dynamic block are its commands too).
+ *        A committer thread writes appended records by one sequential stream
+ *        and fsyncs them together on an interval or a byte budget.
+ *        On restart the commands of not done blocks are replayed into the pipeline.
+ *        Once the journal grows over its compaction size, the committer drops its head
+ *        below the first unfinished command (the low watermark): the tail is copied
+ *        into a new file, which replaces the journal atomically.
+ *
+ *        Journal file: records of journal_record_t header, followed by
+ *          Cmd:  command bytes
+ *          Done: uint64 LSNs of the block's commands
+ *        All integers are written in host byte order. A torn record ends the journal.
+ */
+#pragma once
+#include "async_internal.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+struct cmd_block_t;
+class journal_t;
+
+/**
+ * @brief Log sequence number of a command which is not journaled
+ */
+constexpr uint64_t no_lsn = 0;
+
+/**
+ * @brief Suffix of a journal taken for replay
+ */
+constexpr auto replay_ext = ".replay";
+
+/**
+ * @brief Suffix of a compacted journal, before it replaces the journal
+ */
+constexpr auto compact_ext = ".compact";
+
+/**
+ * @brief Header of a journal record
+ */
+struct journal_record_t
+{
+    enum type_t : uint32_t
+    {
+        Cmd = 1, // a received command
+        Done     // a block output by all the sinks
+    };
+    uint32_t length;       // payload length
+    uint32_t type;         // type_t
+    uint64_t id;           // Cmd: LSN; Done: block sequence number
+    uint64_t handle;       // Cmd: connection handle; Done: unused
+    uint32_t checksum;     // FNV-1a of the payload
+    uint32_t reserved = 0; // keeps header 8-bytes aligned
+};
+
+/**
+ * @brief Countdown of the sinks, which are still to write a journaled block, shared by the block's copies
+ *        (a sink's overflow spill reads a block back as a new copy). The block is journaled as done,
+ *        when the last sink has written it, not when it is buffered or spilled;
+ *        a block, dropped by a sink's overflow policy, is forgotten instead
+ */
+struct journal_countdown_t
+{
+    std::atomic<size_t> left;         // sinks, which have not written or dropped the block yet
+    std::atomic<bool> dropped{false}; // a sink dropped the block
+    journal_t &journal;               // the instance's journal
+    journal_countdown_t(size_t n_sinks, journal_t &_journal) : left(n_sinks), journal(_journal) {}
+    void written(const cmd_block_t &block);         // a sink has written the block
+    void dropped_by_sink(const cmd_block_t &block); // a sink dropped the block
+};
+
+/**
+ * @brief A function which replays an unfinished command
+ */
+using replay_fn_t = std::function<void(connection_handle_t, const std::string &)>;
+
+/**
+ * @brief Write-ahead journal with group commit
+ */
+class journal_t
+{
+private:
+    int fd = -1;                                    // journal file
+    std::string path;                               // journal file path
+    std::mutex mtx;                                 // guards the fields below
+    std::condition_variable cv;                     // wakes the committer up
+    std::condition_variable committed_cv;           // wakes 'sync' callers and throttled appenders up
+    std::string buf;                                // appended, not yet written records
+    uint64_t next_lsn = no_lsn + 1;                 // LSN of the next command
+    uint64_t appended = 0;                          // bytes appended
+    uint64_t durable = 0;                           // bytes written and fsynced
+    uint64_t file_base = 0;                         // appended bytes before the journal file's head, dropped by compaction
+    uint64_t compact_bytes = 64 << 20;              // the journal file is compacted, when it grows over it; 0 - never
+    uint64_t watermark = no_lsn + 1;                // the lowest LSN, whose block is not output
+    std::deque<std::pair<uint64_t, bool>> pending;  // from the watermark on: offsets of Cmd records and whether they are resolved
+    bool urgent = false;                            // commit without waiting for the interval
+    bool stopping = false;                          // the committer exits after the last commit
+    std::chrono::milliseconds interval{2};          // commit interval
+    size_t budget = 256 * 1024;                     // bytes which trigger commit before the interval
+    std::thread committer;                          // the committer thread
+    void run();                                     // the committer thread function
+    void put(journal_record_t::type_t type, uint64_t id, uint64_t handle,
+             const void *payload, size_t length);   // appends a record, mtx is held
+    void resolve(const std::vector<uint64_t> &lsns); // advances the watermark over output or dropped commands, mtx is held
+    void compact(uint64_t cut, uint64_t end);       // replaces the journal with its bytes [cut, end), on the committer thread
+
+public:
+    ~journal_t() { close(false); }
+    bool enabled() const { return fd >= 0; }
+    bool open(const std::string &_path, unsigned interval_ms, size_t budget_bytes,
+              size_t _compact_bytes);                                             // takes the previous journal for replay
+    uint64_t append(connection_handle_t ch, const std::string &cmd);              // journals a command, returns its LSN
+    void done(uint64_t seq, const std::vector<uint64_t> &lsns);                   // a block is written by all the sinks
+    void forget(const std::vector<uint64_t> &lsns);                               // commands are not to be output: dropped or empty block
+    void replay(const replay_fn_t &fn);                                           // replays unfinished commands of the previous journal
+    void replayed();                                                              // commits replayed commands, removes the previous journal
+    void sync();                                                                  // waits until everything appended is durable
+    void close(bool remove);                                                      // commits and stops; removes the journal after a clean stop
+};
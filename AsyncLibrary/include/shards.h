@@ -0,0 +1,70 @@
+/**
+ * @brief shards.h - shared-nothing sharded execution mode of 'async' library.
+ *        Each shard thread owns the input contexts of its connections (handle % nof shards)
+ *        without locks, forms their dynamic blocks locally and publishes finished blocks
+ *        through its own single-producer ring; one collector thread moves published blocks
+ *        into the output queue. Only static commands cross shards.
+ */
+#pragma once
+#include "async_internal.h"
+#include "ingress.h"
+#include "spsc_ring.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief A finished block, published by a shard
+ */
+struct published_block_t
+{
+    connection_handle_t handle;
+    cmds_t cmds;
+    lsns_t lsns;
+    std::unique_ptr<block_spill_t> spill; // commands of an oversized block instead of cmds
+};
+
+/**
+ * @brief Capacity of a shard's ring of published blocks
+ */
+constexpr size_t shard_ring_capacity = 1024;
+
+/**
+ * @brief A shard: its ingress queue, thread-owned input contexts and published blocks ring
+ */
+struct shard_t
+{
+    library_t &lib;                                                   // the library instance
+    std::unordered_map<connection_handle_t, sp_input_context_t> ctxs; // touched by the shard thread only
+    spsc_ring_t<published_block_t, shard_ring_capacity> published;    // finished blocks for collector
+    ingress_q_t ingress;                                              // operations on the shard's connections
+    explicit shard_t(library_t &_lib);
+    void apply(ingress_op_t &op);                                     // applies an operation in the shard thread
+    void publish(connection_handle_t ch, input_context_t &ctx);       // pushes a dynamic block to collector, clears it
+};
+
+/**
+ * @brief All the shards and the collector
+ */
+struct shards_t
+{
+    library_t &lib;                             // the library instance
+    size_t n_shards;                            // 0 - sharded mode is off
+    std::once_flag launched;                    // shards and collector are created on first use
+    std::vector<std::unique_ptr<shard_t>> pool; // the shards
+    std::thread collector;                      // the collector thread
+    std::atomic<bool> stopping{false};          // collector exits when the rings are empty
+    std::atomic<uint64_t> doorbell{0};          // bumped on every publish, collector waits on it
+    std::atomic<size_t> in_flight{0};           // published, not yet moved into output queue
+    shards_t(library_t &_lib, size_t _n_shards) : lib(_lib), n_shards(_n_shards) {}
+    ~shards_t() { stop(); }
+    bool enabled() const { return n_shards > 0; }
+    shard_t &of(connection_handle_t ch);        // the shard owning a connection
+    void collect();                             // the collector thread function
+    void flush();                               // applies posted operations, waits until published blocks are collected
+    void terminate();                           // pushes the rest of dynamic commands into output queue
+    void stop();                                // joins shard threads and collector
+};
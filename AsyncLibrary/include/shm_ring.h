@@ -0,0 +1,106 @@
+/**
+ * @brief shm_ring.h - shared-memory ingestion ring of 'async' library for producers on the same host
+ *
+ *        A producer creates a 'memfd' with the ring and an 'eventfd' doorbell and passes both
+ *        to the server over an AF_UNIX socket (SCM_RIGHTS); the ring then acts as one connection.
+ *        Ring memory: ring header, then 'capacity' bytes of frames: uint32 len + command bytes,
+ *        wrapping around the end of the data area. Integers are in host byte order.
+ *        The doorbell is rung only when the consumer sleeps, so a busy ring costs no syscalls.
+ *        The producer is not trusted: the memfd must be sealed against shrinking, and the consumer
+ *        keeps its own read position and checks every position and length it reads from the ring.
+ */
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * @brief Magic word which starts the ring header
+ */
+constexpr char shm_ring_magic[8] = {'S', 'H', 'M', 'R', 'I', 'N', 'G', '1'};
+
+/**
+ * @brief Default size of ring data area, a power of 2
+ */
+constexpr size_t shm_ring_capacity = 1024 * 1024;
+
+/**
+ * @brief Ring header at the start of the shared memory
+ */
+struct shm_ring_header_t
+{
+    char magic[8];                               // shm_ring_magic
+    uint64_t capacity;                           // size of data area, a power of 2
+    alignas(64) std::atomic<uint64_t> head;      // bytes consumed, advanced by consumer
+    alignas(64) std::atomic<uint64_t> tail;      // bytes produced, advanced by producer
+    alignas(64) std::atomic<uint32_t> sleeping;  // consumer waits for the doorbell
+    std::atomic<uint32_t> closed;                // producer has disconnected
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "ring atomics are shared between processes");
+
+/**
+ * @brief Mapping of the ring memory, common for both sides
+ */
+class shm_ring_t
+{
+protected:
+    shm_ring_header_t *hdr = nullptr; // mapped header, followed by data area
+    uint64_t capacity = 0;            // size of data area, never re-read from shared header
+    size_t map_size = 0;              // mapped bytes
+    int mem_fd = -1;                  // memfd of the ring
+    int bell_fd = -1;                 // eventfd doorbell
+    char *data() const { return reinterpret_cast<char *>(hdr + 1); }
+    void copy_in(uint64_t pos, const void *src, size_t n);  // writes into data area with wrapping
+    void copy_out(uint64_t pos, void *dst, size_t n) const; // reads from data area with wrapping
+
+public:
+    shm_ring_t() = default;
+    shm_ring_t(const shm_ring_t &) = delete;
+    shm_ring_t &operator=(const shm_ring_t &) = delete;
+    ~shm_ring_t() { unmap(); }
+    void unmap();                             // unmaps memory and closes descriptors
+    int doorbell() const { return bell_fd; } // eventfd, readable when the producer rings
+};
+
+/**
+ * @brief Producer side: creates the ring, hands it over to the server, writes commands
+ */
+class shm_producer_t : public shm_ring_t
+{
+public:
+    bool open(const char *socket_path, size_t capacity = shm_ring_capacity); // creates ring and passes it to server
+    void send(std::string_view cmd);                                          // writes a command; waits while ring is full
+    void close();                                                             // marks the ring closed - disconnect
+    ~shm_producer_t() { close(); }
+};
+
+/**
+ * @brief Consumer side: maps the ring received from a producer, takes commands out
+ */
+class shm_consumer_t : public shm_ring_t
+{
+private:
+    uint64_t head = 0;   // bytes consumed: the consumer's own copy, published to the header
+    bool broken = false; // the producer wrote inconsistent positions or frames: the ring is rejected
+
+public:
+    bool attach(int _mem_fd, int _bell_fd); // maps the ring, takes over descriptors
+    size_t fetch(std::vector<std::string> &cmds, size_t max_cmds); // appends commands; returns nof taken
+    bool sleep();        // announces waiting for doorbell; false if ring is not empty or closed
+    void wake();         // consumes doorbell events
+    bool closed() const; // producer has disconnected and all the commands are taken, or the ring is broken
+    bool malformed() const { return broken; } // the ring is rejected for inconsistent positions or frames
+};
+
+/**
+ * @brief Receives ring descriptors, passed by 'shm_producer_t::open' over an AF_UNIX socket
+ * @param socket_fd the accepted socket
+ * @param mem_fd ring memfd
+ * @param bell_fd doorbell eventfd
+ * @return false if no descriptors are received
+ */
+bool shm_receive_fds(int socket_fd, int &mem_fd, int &bell_fd);
@@ -0,0 +1,150 @@
+/**
+ * @brief sink.h - output sinks of 'async' library.
+ *        Every formed block is shared by all the registered sinks; each sink has its own
+ *        buffer, threads and overflow policy, so a slow sink never holds blocks
+ *        or threads of the others. Built-in sinks: console, file, TCP forwarder
+ */
+#pragma once
+#include "async.h"
+#include "block_store.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct cmd_block_t;
+struct journal_countdown_t;
+
+/**
+ * @brief A block shared by all the sinks; it is released, when the last sink has output it
+ */
+using sp_block_t = std::shared_ptr<const cmd_block_t>;
+
+/**
+ * @brief A mark in a sink's spill file instead of the commands count: the block has its own spill file
+ *        and is kept by reference
+ */
+constexpr uint32_t spilled_ref = UINT32_MAX;
+
+/**
+ * @brief Output sink interface; 'write' is called by the sink's threads concurrently,
+ *        if the sink has several of them
+ */
+class sink_t
+{
+public:
+    virtual ~sink_t() = default;
+    virtual std::string name() const = 0;             // short name for spill file and messages
+    virtual bool open() { return true; }              // called before the sink's threads start
+    virtual void write(const cmd_block_t &block) = 0; // outputs a block
+    virtual void stop() {}                            // the instance stops: give up on an unreachable destination
+    virtual void close() {}                           // called after the sink's threads exit
+    virtual bool remote() const { return false; }     // writes wait for a peer: keeps its threads in inline output mode
+};
+
+/**
+ * @brief Console sink: 'block: ...' lines to stdout
+ */
+class console_sink_t : public sink_t
+{
+public:
+    std::string name() const override { return "console"; }
+    void write(const cmd_block_t &block) override;
+};
+
+/**
+ * @brief File sink: a text file per block or the binary block store
+ */
+class file_sink_t : public sink_t
+{
+private:
+    edit::file_format_t file_format; // format of file output
+    std::string log_dir;             // a path to output files
+    block_store_t store;             // binary block store, used with file_format_t::block_store
+
+public:
+    file_sink_t(edit::file_format_t _file_format, std::string _log_dir)
+        : file_format(_file_format), log_dir(std::move(_log_dir)) {}
+    std::string name() const override { return "file"; }
+    bool open() override;
+    void write(const cmd_block_t &block) override;
+    void close() override;
+};
+
+/**
+ * @brief TCP forwarder sink: 'block: ...' lines to a downstream aggregator over one connection;
+ *        reconnects while the aggregator is unreachable, so its buffer absorbs the outage.
+ *        A line is framed by its '\n': if the connection breaks in the middle of a line, the new
+ *        connection sends the line again from its start, so the receiver must discard the unterminated
+ *        tail of the broken connection (bulk_server does). Lines, sent as a whole, are not sent again
+ */
+class tcp_sink_t : public sink_t
+{
+private:
+    std::string ip_addr;                          // aggregator address
+    uint16_t port;                                // aggregator port
+    std::mutex mtx;                               // one connection, serializes writers
+    int fd = -1;                                  // the connection, guarded by mtx
+    std::atomic<bool> stopping{false};            // pending writes are dropped, if the aggregator is unreachable
+    bool reconnect();                             // (re)establishes the connection, mtx is held
+    void write_spilled(const cmd_block_t &block); // sends a spilled block by pieces
+
+public:
+    tcp_sink_t(std::string _ip_addr, uint16_t _port) : ip_addr(std::move(_ip_addr)), port(_port) {}
+    std::string name() const override { return "forward"; }
+    bool remote() const override { return true; }
+    void write(const cmd_block_t &block) override;
+    void stop() override { stopping.store(true); }
+    void close() override;
+};
+
+/**
+ * @brief A sink with its own bounded queue, threads and overflow policy;
+ *        in inline output mode, a small batch of blocks, written by the pushing thread
+ */
+class sink_runner_t
+{
+private:
+    std::unique_ptr<sink_t> sink;               // the sink
+    edit::sink_options_t options;               // workers, buffer limit, overflow policy
+    std::chrono::microseconds spin;             // the threads spin so long before sleeping
+    std::mutex mtx;                             // guards the queue and the spill file
+    std::condition_variable ready_cv;           // wakes the sink's threads up
+    std::condition_variable room_cv;            // wakes a producer, blocked by a full queue
+    std::deque<sp_block_t> q;                   // buffered blocks
+    std::string spill_path;                     // spill file, overflow_t::spill
+    std::fstream spill;                         // spill file stream, opened on first overflow
+    uint64_t spill_read = 0;                    // read position in spill file
+    size_t spilled = 0;                         // nof blocks in spill file, newer than the ones in q
+    std::deque<sp_block_t> spilled_refs;        // spilled blocks, whose commands are in their own spill files
+    std::deque<std::shared_ptr<journal_countdown_t>> spilled_countdowns; // journal countdowns of the blocks in spill file
+    size_t n_dropped = 0;                       // statistics: blocks dropped by overflow_t::drop_oldest
+    size_t n_spilled = 0;                       // statistics: blocks passed through spill file
+    bool stopping = false;                      // the threads exit when nothing is left
+    bool pacing = true;                         // the fair queue's dispatcher waits for credit, see wait_credit
+    std::vector<std::thread> workers;           // the sink's threads
+    size_t inline_batch;                        // inline output: blocks are written on the pushing thread by so many; 0 - off
+    void run();                                 // the sink's thread function
+    void write_inline();                        // writes the blocks of q on the calling thread, mtx is held
+    void spill_block(const sp_block_t &block);  // appends a block to spill file, mtx is held
+    sp_block_t unspill_block();                 // reads the oldest spilled block, mtx is held
+
+public:
+    sink_runner_t(std::unique_ptr<sink_t> _sink, const edit::sink_options_t &_options, const std::string &spill_dir,
+                  std::chrono::microseconds _spin, size_t _inline_batch = 0);
+    void push(const sp_block_t &block); // buffers a block, applying the overflow policy, or writes a batch inline;
+                                        // never waits for room, see wait_room
+    void wait_room();                   // overflow_t::block: waits until the buffer is within its limit
+    void flush_inline();                // inline output: writes a partial batch
+    void wait_credit(size_t credit);    // overflow_t::block: waits until the sink's threads have taken all but credit blocks
+    void end_pacing();                  // wait_credit no longer waits
+    void launch();                      // opens the sink and launches its threads, if not inline
+    void stop();                        // outputs the rest of blocks, joins the threads, closes the sink
+};
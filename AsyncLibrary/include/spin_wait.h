@@ -0,0 +1,68 @@
+/**
+ * @brief spin_wait.h - bounded spinning before sleeping, used by library threads in low-latency mode:
+ *        a thread, which spins, is woken up by the next item without a futex wake-up,
+ *        and the producer's notify finds no sleeper to wake
+ */
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief A hint to CPU, that the thread spins
+ */
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#else
+    std::this_thread::yield();
+#endif
+}
+
+/**
+ * @brief Waits on a condition variable; spins for a while first, releasing the lock between checks
+ * @param lock the lock of cv's mutex, held
+ * @param cv condition variable
+ * @param spin spinning time; zero - no spinning
+ * @param pred the condition to wait for
+ */
+template <typename Pred>
+void spin_wait(std::unique_lock<std::mutex> &lock, std::condition_variable &cv, std::chrono::microseconds spin, Pred pred)
+{
+    if (spin.count() && !pred())
+    {
+        auto deadline = std::chrono::steady_clock::now() + spin;
+        do
+        {
+            lock.unlock();
+            for (int i = 0; i < 64; ++i)
+                cpu_relax();
+            lock.lock();
+        } while (!pred() && std::chrono::steady_clock::now() < deadline);
+    }
+    cv.wait(lock, pred);
+}
+
+/**
+ * @brief Waits until an atomic value changes; spins for a while first
+ * @param value the atomic
+ * @param old the value to wait a change of
+ * @param spin spinning time; zero - no spinning
+ */
+template <typename T>
+void spin_wait(std::atomic<T> &value, T old, std::chrono::microseconds spin)
+{
+    if (spin.count())
+    {
+        auto deadline = std::chrono::steady_clock::now() + spin;
+        while (value.load(std::memory_order_acquire) == old && std::chrono::steady_clock::now() < deadline)
+            cpu_relax();
+    }
+    value.wait(old, std::memory_order_acquire);
+}
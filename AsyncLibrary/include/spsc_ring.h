@@ -0,0 +1,42 @@
+/**
+ * @brief spsc_ring.h - bounded lock-free single-producer single-consumer ring
+ */
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @brief Bounded lock-free single-producer single-consumer ring
+ * @tparam T element type
+ * @tparam N capacity
+ */
+template <typename T, size_t N>
+class spsc_ring_t
+{
+private:
+    std::array<T, N> slots;
+    alignas(64) std::atomic<size_t> head{0}; // next slot to pop, advanced by consumer
+    alignas(64) std::atomic<size_t> tail{0}; // next slot to push, advanced by producer
+
+public:
+    bool try_push(T &value) // moves the value in, if there is room
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N)
+            return false;
+        slots[t % N] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+    bool try_pop(T &value) // moves the oldest value out, if any
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        value = std::move(slots[h % N]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+    bool empty() const { return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire); }
+};
@@ -7,6 +7,7 @@
 #include "async_internal.h"
 #include "cmd_output.h"
 #include "async.h"
+#include "instance.h"
 #include "common.h"
 #include <chrono>
 #include <string>
@@ -42,8 +43,8 @@ bool input_connections_t::delete_connection(connection_handle_t ch)
  */
 bool input_connections_t::empty()
 {
-    std::lock_guard(input_connections.mtx);
-    return input_connections.ctxs.empty();
+    std::lock_guard g(mtx);
+    return ctxs.empty();
 }
 
 /**
@@ -63,14 +64,307 @@ lexema_t make_lexema(const std::string buf)
 /**
  * @brief Thread-safely save a 'static' cmd to the 'cmds' buffer
  *        output the whole 'cmds' to output blocks queue, when it grows appropriate size
- * @param buf buffer, containing the new 'static' cmd
+ * @param cmd the new 'static' cmd
+ * @param lsn journal LSN of the cmd
  */
-void static_cmds_buf_t::save_static_cmd(const std::string buf)
+void static_cmds_buf_t::save_static_cmd(cmd_t cmd, uint64_t lsn)
 {
     std::lock_guard g(mtx);
-    cmds.emplace_back(buf);
+    cmds.push_back(std::move(cmd));
+    if (lsn != no_lsn)
+        lsns.push_back(lsn);
     if (cmds.size() == block_size)
-        output_context()->blocks_q.erase_push(cmds); // Put into output q
+        blocks_q.push(cmds, lsns, static_handle); // Put into output q
+}
+
+/**
+ * @brief Creates instance internals; threads are launched lazily
+ * @param _options instance parameters
+ */
+library_t::library_t(const options_t &_options)
+    : options(_options), intern(options.intern, options.intern_max_length), output(options, journal), shards(*this, options.shards),
+      ingress([this](ingress_op_t &op)
+              { apply(op); },
+              std::chrono::microseconds(options.spin_us),
+              [this]()
+              { output.blocks_q.flush_inline(); })
+{
+    if (options.journal && !journal.open(options.journal, options.journal_interval_ms, options.journal_bytes, options.journal_compact))
+    {
+        std::cerr << "journal open error" << std::endl;
+        std::quick_exit(2);
+    }
+}
+
+/**
+ * @brief Journals a command before it is applied
+ * @param ch connection handle
+ * @param buf the command
+ * @return LSN of the command, or no_lsn if there is no journal
+ */
+uint64_t library_t::journal_cmd(connection_handle_t ch, const std::string &buf)
+{
+    return journal.enabled() ? journal.append(ch, buf) : no_lsn;
+}
+
+/**
+ * @brief Applies a command to an input context: put it into common static q or local dynamic q
+ * @param ctx input context of the connection
+ * @param buf Buffer containing the command
+ * @param lsn journal LSN of the command
+ * @return true if a dynamic block is finished in ctx.dyna_cmds
+ */
+bool library_t::process_cmd(input_context_t &ctx, const std::string &buf, uint64_t lsn)
+{
+    auto lexema = make_lexema(buf);
+    int lex_id = lexema.first; // lexema.first: Lex enum,
+                               // lexema.second: command string, if any, or ""
+    switch (lex_id)
+    {
+    case Cmd: // command received
+        if (ctx.dynamic_depth == 0)
+            output.static_cmds.save_static_cmd(intern.intern(buf), lsn); // put it into common static q
+        else
+        {
+            add_dynamic_cmd(ctx, lexema.second); // put it into local dynamic q
+            if (lsn != no_lsn)
+                ctx.dyna_lsns.push_back(lsn);
+        }
+        break;
+    case OpenBr:              // '{'
+        (ctx.dynamic_depth)++; // nested '{' are accounted to errorlessly accept nested '}'
+        if (lsn != no_lsn)
+            ctx.dyna_lsns.push_back(lsn); // brackets are done with their block
+        break;
+    case CloseBr: // '}'
+        if ((--(ctx.dynamic_depth)) < 0)
+        { // unpair close bracket!
+            std::cerr << "Unpair close bracket" << std::endl;
+            std::quick_exit(2);
+        }
+        if (lsn != no_lsn)
+            ctx.dyna_lsns.push_back(lsn);
+        return ctx.dynamic_depth == 0; // dynamic block is finishing
+    default:
+        std::cerr << "Unknown command" << std::endl;
+        std::quick_exit(2);
+        break;
+    };
+    return false;
+}
+
+/**
+ * @brief Puts a command into a connection's dynamic block: in memory, until the block grows over
+ *        options.dynamic_cap bytes, then into the block's spill file, where the commands in memory go first
+ * @param ctx input context of the connection
+ * @param cmd the command
+ */
+void library_t::add_dynamic_cmd(input_context_t &ctx, const std::string &cmd)
+{
+    ctx.dyna_bytes += cmd.size();
+    if (!ctx.dyna_spill && options.dynamic_cap && ctx.dyna_bytes > options.dynamic_cap)
+    {
+        ctx.dyna_spill = block_spill_t::create(options.log_dir);
+        if (!ctx.dyna_spill)
+        {
+            std::cerr << "dynamic block spill open error" << std::endl;
+            std::quick_exit(2);
+        }
+        for (auto &c : ctx.dyna_cmds)
+            ctx.dyna_spill->append(c);
+        cmds_t().swap(ctx.dyna_cmds);
+        n_spilled.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (ctx.dyna_spill)
+        ctx.dyna_spill->append(cmd);
+    else
+        ctx.dyna_cmds.push_back(intern.intern(cmd));
+}
+
+/**
+ * @brief Applies a command to a lazily allocated input context: a connection out of dynamic blocks
+ *        has no context, its static commands need none; an open bracket allocates it
+ * @param ctx input context of the connection, or nullptr
+ * @param buf Buffer containing the command
+ * @param lsn journal LSN of the command
+ * @return true if a dynamic block is finished in ctx->dyna_cmds
+ */
+bool library_t::process_cmd(sp_input_context_t &ctx, const std::string &buf, uint64_t lsn)
+{
+    if (ctx)
+        return process_cmd(*ctx, buf, lsn);
+    input_context_t idle(options.block_size); // no heap, unless the command opens a dynamic block
+    bool finished = process_cmd(idle, buf, lsn);
+    if (idle.dynamic_depth)
+    {
+        ctx = std::make_shared<input_context_t>(std::move(idle));
+        n_contexts.fetch_add(1, std::memory_order_relaxed);
+    }
+    return finished;
+}
+
+/**
+ * @brief Frees the input context of a connection, whose dynamic block is finished and output
+ * @param ctx input context of the connection, or nullptr
+ */
+void library_t::release_context(sp_input_context_t &ctx)
+{
+    if (!ctx)
+        return;
+    ctx.reset();
+    n_contexts.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Adds a connection with the given handle to the pool and launches output threads;
+ *        its input context is allocated on demand
+ * @param handle connection handle, allocated by caller
+ */
+void library_t::open_connection(connection_handle_t handle)
+{
+    {
+        std::lock_guard lock(input_connections.mtx);
+
+        // Add new connection handle to the set of connections
+        input_connections.ctxs.emplace(handle, nullptr);
+    }
+    n_connections.fetch_add(1, std::memory_order_relaxed);
+
+    // Launch output threads if they are not launched yet
+    output.try_to_launch();
+}
+
+/**
+ * @brief Receives exactly one command and put it into static or dynamic queue
+ * @param ch Handle for connection
+ * @param buf Buffer containing the command
+ */
+void library_t::receive(connection_handle_t ch, const std::string &buf)
+{
+    sp_input_context_t inp_ctx;
+    {
+        std::lock_guard lock(input_connections.mtx);
+        auto p = input_connections.ctxs.find(ch);
+        if (p == input_connections.ctxs.end())
+            return;
+        inp_ctx = p->second;
+    }
+
+    auto lsn = journal_cmd(ch, buf);
+    bool had_ctx = bool(inp_ctx);
+    if (process_cmd(inp_ctx, buf, lsn)) // dynamic block is finishing
+    {
+        output.blocks_q.push(*inp_ctx, ch); // Put block into output q and clear it
+        release_context(inp_ctx);
+    }
+    if (had_ctx != bool(inp_ctx)) // the context is allocated or released
+    {
+        std::lock_guard lock(input_connections.mtx);
+        auto p = input_connections.ctxs.find(ch);
+        if (p != input_connections.ctxs.end())
+            p->second = inp_ctx;
+    }
+}
+
+/**
+ * @brief Delete connection corresponding to the given handle;
+ *        forms a block from the rest of input cmd queue
+ *        and pushes it into output blocks queue
+ * @param ch Handle for connection
+ */
+void library_t::disconnect(connection_handle_t ch)
+{
+    sp_input_context_t inp_ctx;
+    {
+        std::lock_guard lock(input_connections.mtx);
+        auto p = input_connections.ctxs.find(ch);
+        if (p == input_connections.ctxs.end())
+            return;
+        inp_ctx = p->second;
+    }
+
+    // Push the last block to output queue
+    if (inp_ctx)
+        output.blocks_q.push(*inp_ctx, ch);
+    release_context(inp_ctx);
+
+    // Delete connection
+    if (input_connections.delete_connection(ch))
+        n_connections.fetch_sub(1, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Applies a posted operation with the synchronous interface
+ * @param op operation to apply
+ */
+void library_t::apply(ingress_op_t &op)
+{
+    switch (op.kind)
+    {
+    case ingress_op_t::Connect:
+        open_connection(op.handle);
+        break;
+    case ingress_op_t::Receive:
+        for (auto &cmd : op.cmds)
+            if (cmd.size())
+                receive(op.handle, cmd);
+        break;
+    case ingress_op_t::Disconnect:
+        disconnect(op.handle);
+        break;
+    }
+}
+
+/**
+ * @brief The ingress queue, which applies operations on a connection
+ * @param ch connection handle
+ */
+ingress_q_t &library_t::ingress_for(connection_handle_t ch)
+{
+    return shards.enabled() ? shards.of(ch).ingress : ingress;
+}
+
+/**
+ * @brief Applies posted operations, calls disconnect for every connection
+ *        pushes the rest of static cmds buffer(queue) into output blocks queue,
+ *        waits until everything is output and stops the threads
+ */
+void library_t::terminate()
+{
+    std::lock_guard g(terminate_mtx);
+    if (terminated)
+        return;
+    terminated = true;
+
+    ingress.stop();
+    if (shards.enabled())
+        shards.terminate();
+
+    std::vector<connection_handle_t> handles;
+    {
+        std::lock_guard lock(input_connections.mtx);
+        for (auto &cn : input_connections.ctxs)
+            handles.push_back(cn.first);
+    }
+    for (auto ch : handles)
+        disconnect(ch);
+    {
+        std::lock_guard lock(output.static_cmds.mtx);
+        output.blocks_q.push(output.static_cmds.cmds, output.static_cmds.lsns, static_handle);
+    }
+    output.stop();
+    journal.close(true); // everything is output
+}
+
+/**
+ * @brief Waits until posted operations are applied
+ */
+void library_t::flush()
+{
+    if (shards.enabled())
+        shards.flush();
+    else
+        ingress.flush();
 }
 
 /**
@@ -80,23 +374,86 @@ namespace edit
 {
 
     /**
-     * @brief Creates new connection to input commands queue
-     * @param block_size - nof cmds in command block
-     * @return a handle to the created connection
+     * @brief Creates an instance; replays unfinished commands of the previous journal, if any:
+     *        each connection of the previous run is replayed by a connection of its own,
+     *        which is disconnected after replay
+     * @param options instance parameters
      */
-    connection_handle_t connect(std::size_t block_size, const char *log_dir)
+    instance_t::instance_t(const options_t &options) : lib(std::make_unique<library_t>(options))
     {
-        connection_handle_t handle;
-        {
-            std::lock_guard lock(input_connections.mtx);
+        if (!lib->journal.enabled())
+            return;
+        std::unordered_map<connection_handle_t, connection_handle_t> replayed;
+        lib->journal.replay([&](connection_handle_t ch, const std::string &cmd)
+                            {
+                                auto [p, added] = replayed.try_emplace(ch);
+                                if (added)
+                                    p->second = connect();
+                                receive(p->second, cmd); });
+        for (auto &[ch, handle] : replayed)
+            disconnect(handle);
+        lib->flush();
+        lib->journal.replayed();
+    }
 
-            // Add new connection handle to the set of connections
-            handle = input_connections.ctxs.emplace(std::make_pair(input_connections.ctxs.size(), new input_context_t(block_size))).first->first;
-        }
+    instance_t::~instance_t() { terminate(); }
+
+    const options_t &instance_t::options() const { return lib->options; }
 
-        // Launch output threads if they are not launched yet
-        output_context(block_size)->th_pool.try_to_launch(log_dir);
+    /**
+     * @brief Memory accounting of the instance's connections
+     * @return open connections and their allocated input contexts
+     */
+    instance_stats_t instance_t::stats() const
+    {
+        instance_stats_t stats;
+        stats.connections = lib->n_connections.load(std::memory_order_relaxed);
+        stats.contexts = lib->n_contexts.load(std::memory_order_relaxed);
+        stats.context_bytes = stats.contexts * sizeof(input_context_t);
+        stats.spilled_blocks = lib->n_spilled.load(std::memory_order_relaxed);
+        return stats;
+    }
 
+    /**
+     * @brief Fairness metrics of the instance's output queue, see fair_options_t
+     * @return the metrics since the previous call; zeros if fair scheduling is off
+     */
+    fairness_stats_t instance_t::fairness()
+    {
+        return lib->output.blocks_q.fairness();
+    }
+
+    /**
+     * @brief Statistics of the instance's command intern table, see options_t::intern
+     * @return entries, bytes, hits, misses, evictions; zeros if interning is off
+     */
+    intern_stats_t instance_t::interning() const
+    {
+        return lib->intern.stats();
+    }
+
+    /**
+     * @brief Registers one more output sink; every block is output by all the sinks,
+     *        each at its own pace, with its own threads and buffer
+     * @param sink the sink
+     * @param sink_options workers, buffer limit, overflow policy
+     */
+    void instance_t::add_sink(std::unique_ptr<sink_t> sink, const sink_options_t &sink_options)
+    {
+        if (sink_options.workers)
+            lib->output.blocks_q.add(std::move(sink), sink_options, lib->options.log_dir);
+    }
+
+    /**
+     * @brief Creates new connection to the instance's input commands queue
+     * @return a handle to the created connection
+     */
+    connection_handle_t instance_t::connect()
+    {
+        if (lib->shards.enabled())
+            return post_connect(nullptr);
+        auto handle = lib->input_connections.next_handle++;
+        lib->open_connection(handle);
         return handle;
     }
 
@@ -105,41 +462,14 @@ namespace edit
      * @param ch Handle for connection, created by connect
      * @param buf Buffer containing the command
      */
-    void receive(connection_handle_t ch, const std::string buf)
+    void instance_t::receive(connection_handle_t ch, const std::string buf)
     {
-
         if (!buf.size())
             return;
-        auto inp_ctx = input_connections.ctxs[ch];
-
-        auto lexema = make_lexema(buf);
-        int lex_id = lexema.first; // lexema.first: Lex enum,
-                                   // lexema.second: command string, if any, or ""
-        switch (lex_id)
-        {
-        case Cmd: // command received
-            if (inp_ctx->dynamic_depth == 0)
-                output_context()->static_cmds.save_static_cmd(buf); // put it into common static q
-            else
-                inp_ctx->dyna_cmds.emplace_back(lexema.second); // put it into local dynamic q
-            break;
-        case OpenBr:                    // '{'
-            (inp_ctx->dynamic_depth)++; // nested '{' are accounted to errorlessly accept nested '}'
-            break;
-        case CloseBr: // '}'
-            if ((--(inp_ctx->dynamic_depth)) < 0)
-            { // unpair close bracket!
-                std::cerr << "Unpair close bracket" << std::endl;
-                std::quick_exit(2);
-            }
-            if ((inp_ctx->dynamic_depth) == 0)                             // dynamic block is finishing
-                output_context()->blocks_q.erase_push(inp_ctx->dyna_cmds); // Put block into output q and clear it
-            break;
-        default:
-            std::cerr << "Unknown command" << std::endl;
-            std::quick_exit(2);
-            break;
-        };
+        if (lib->shards.enabled())
+            post_receive(ch, {buf}, nullptr);
+        else
+            lib->receive(ch, buf);
     }
 
     /**
@@ -148,27 +478,189 @@ namespace edit
      *        and pushes it into output blocks queue
      * @param ch Handle for connection, created by 'connect'
      */
+    void instance_t::disconnect(connection_handle_t ch)
+    {
+        if (lib->shards.enabled())
+            post_disconnect(ch, nullptr);
+        else
+            lib->disconnect(ch);
+    }
+
+    /**
+     * @brief Non-blocking 'connect'
+     * @param on_accepted called when the operation is accepted
+     * @return a handle to the connection
+     */
+    connection_handle_t instance_t::post_connect(connect_callback_t on_accepted)
+    {
+        auto handle = lib->input_connections.next_handle++;
+        accept_callback_t with_handle;
+        if (on_accepted)
+            with_handle = [on_accepted, handle]()
+            { on_accepted(handle); };
+        lib->ingress_for(handle).post({.kind = ingress_op_t::Connect, .handle = handle, .on_accepted = std::move(with_handle)});
+        return handle;
+    }
+
+    /**
+     * @brief Non-blocking 'receive' of several commands
+     * @param ch Handle for connection, created by post_connect
+     * @param cmds commands
+     * @param on_accepted called when the operation is accepted
+     */
+    void instance_t::post_receive(connection_handle_t ch, std::vector<std::string> cmds, accept_callback_t on_accepted)
+    {
+        lib->ingress_for(ch).post({.kind = ingress_op_t::Receive, .handle = ch, .cmds = std::move(cmds), .on_accepted = std::move(on_accepted)});
+    }
+
+    /**
+     * @brief Non-blocking 'disconnect'
+     * @param ch Handle for connection, created by post_connect
+     * @param on_accepted called when the operation is accepted
+     */
+    void instance_t::post_disconnect(connection_handle_t ch, accept_callback_t on_accepted)
+    {
+        lib->ingress_for(ch).post({.kind = ingress_op_t::Disconnect, .handle = ch, .on_accepted = std::move(on_accepted)});
+    }
+
+    /**
+     * @brief Outputs everything buffered in the instance and stops its threads
+     */
+    void instance_t::terminate()
+    {
+        lib->terminate();
+    }
+
+    /**
+     * @brief The default instance, serving the free functions
+     */
+    static struct default_instance_t
+    {
+        options_t options;                      // set by 'set_file_format', 'set_shards' and the first 'connect'
+        std::mutex mtx;                         // serializes the instance creation
+        std::atomic<instance_t *> ptr{nullptr}; // the instance, created by the first 'connect'
+        instance_t &get()                       // the instance; the first 'connect' must have created it
+        {
+            return *ptr.load(std::memory_order_acquire);
+        }
+        instance_t &get_or_create(std::size_t block_size, const char *log_dir)
+        {
+            auto p = ptr.load(std::memory_order_acquire);
+            if (!p)
+            {
+                std::lock_guard g(mtx);
+                p = ptr.load(std::memory_order_relaxed);
+                if (!p)
+                {
+                    options.block_size = block_size;
+                    options.log_dir = log_dir;
+                    ptr.store(p = new instance_t(options), std::memory_order_release);
+                }
+            }
+            return *p;
+        }
+        ~default_instance_t() { delete ptr.load(); }
+    } default_instance;
+
+    /**
+     * @brief Selects the format of file output
+     * @param format file output format
+     */
+    void set_file_format(file_format_t format)
+    {
+        default_instance.options.file_format = format;
+    }
+
+    /**
+     * @brief Selects sharded execution mode
+     * @param n_shards nof shard threads; 0 - sharded mode is off
+     */
+    void set_shards(std::size_t n_shards)
+    {
+        default_instance.options.shards = n_shards;
+    }
+
+    /**
+     * @brief Enables write-ahead journal
+     * @param path journal file path
+     * @param interval_ms commit interval
+     * @param budget_bytes appended bytes which trigger commit before the interval
+     */
+    void set_journal(const char *path, unsigned interval_ms, std::size_t budget_bytes)
+    {
+        default_instance.options.journal = path;
+        default_instance.options.journal_interval_ms = interval_ms;
+        default_instance.options.journal_bytes = budget_bytes;
+    }
+
+    /**
+     * @brief Creates new connection to input commands queue
+     * @param block_size - nof cmds in command block
+     * @return a handle to the created connection
+     */
+    connection_handle_t connect(std::size_t block_size, const char *log_dir)
+    {
+        return default_instance.get_or_create(block_size, log_dir).connect();
+    }
+
+    /**
+     * @brief Receives exactly one command and put it into static or dynamic queue
+     * @param ch Handle for connection, created by connect
+     * @param buf Buffer containing the command
+     */
+    void receive(connection_handle_t ch, const std::string buf)
+    {
+        default_instance.get().receive(ch, buf);
+    }
+
+    /**
+     * @brief Delete connection corresponding to the given handle
+     * @param ch Handle for connection, created by 'connect'
+     */
     void disconnect(connection_handle_t ch)
     {
+        default_instance.get().disconnect(ch);
+    }
 
-        auto inp_ctx = input_connections.ctxs[ch];
+    /**
+     * @brief Non-blocking 'connect'
+     * @param block_size - nof cmds in command block
+     * @param on_accepted called when the operation is accepted
+     * @param log_dir Path for output files
+     * @return a handle to the connection
+     */
+    connection_handle_t post_connect(std::size_t block_size, connect_callback_t on_accepted, const char *log_dir)
+    {
+        return default_instance.get_or_create(block_size, log_dir).post_connect(std::move(on_accepted));
+    }
 
-        // Push the last block to output queue
-        output_context()->blocks_q.erase_push(inp_ctx->dyna_cmds);
+    /**
+     * @brief Non-blocking 'receive' of several commands
+     * @param ch Handle for connection, created by post_connect
+     * @param cmds commands
+     * @param on_accepted called when the operation is accepted
+     */
+    void post_receive(connection_handle_t ch, std::vector<std::string> cmds, accept_callback_t on_accepted)
+    {
+        default_instance.get().post_receive(ch, std::move(cmds), std::move(on_accepted));
+    }
 
-        // Delete connection
-        input_connections.delete_connection(ch);
+    /**
+     * @brief Non-blocking 'disconnect'
+     * @param ch Handle for connection, created by post_connect
+     * @param on_accepted called when the operation is accepted
+     */
+    void post_disconnect(connection_handle_t ch, accept_callback_t on_accepted)
+    {
+        default_instance.get().post_disconnect(ch, std::move(on_accepted));
     }
 
     /**
-     * @brief Calls disconnect for every connection
-     *        pushes the rest of static cmds buffer(queue) into output blocks queue
+     * @brief Outputs everything buffered in the default instance, if it was created, and stops its threads
      */
     void terminate()
     {
-        for (auto cn : input_connections.ctxs)
-            disconnect(cn.first);
-        output_context()->blocks_q.erase_push(output_context()->static_cmds.cmds);
-        sleep(1);
+        if (auto p = default_instance.ptr.load(std::memory_order_acquire))
+            p->terminate();
     }
-}
\ No newline at end of file
+}
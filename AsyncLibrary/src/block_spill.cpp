@@ -0,0 +1,149 @@
+/**
+ * @brief block_spill.cpp - realizes spill files of oversized dynamic blocks for 'async' library
+ */
+#include "block_spill.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @brief Creates an unlinked spill file
+ * @param dir directory for the file, the log directory
+ * @return the spill; nullptr if the file can't be created
+ */
+std::unique_ptr<block_spill_t> block_spill_t::create(const std::string &dir)
+{
+    int fd = -1;
+#ifdef O_TMPFILE
+    fd = ::open(dir.c_str(), O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    if (fd >= 0)
+        return std::make_unique<block_spill_t>(fd);
+#endif
+    std::string path = dir + "/dyna_XXXXXX";
+    fd = ::mkostemp(path.data(), O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+    ::unlink(path.c_str());
+    return std::make_unique<block_spill_t>(fd);
+}
+
+block_spill_t::~block_spill_t()
+{
+    if (fd >= 0)
+        ::close(fd);
+}
+
+/**
+ * @brief Writes the buffered commands to the file
+ */
+void block_spill_t::write_out()
+{
+    for (size_t written = 0; written < buf.size();)
+    {
+        auto n_written = ::pwrite(fd, buf.data() + written, buf.size() - written, size);
+        if (n_written <= 0)
+        {
+            std::cerr << "dynamic block spill write error" << std::endl;
+            std::quick_exit(2);
+        }
+        written += n_written;
+        size += n_written;
+    }
+    buf.clear();
+}
+
+/**
+ * @brief Appends a command; the file is written by chunks
+ * @param cmd the command
+ */
+void block_spill_t::append(std::string_view cmd)
+{
+    uint32_t length = cmd.size();
+    buf.append(reinterpret_cast<const char *>(&length), sizeof(length));
+    buf.append(cmd);
+    ++n;
+    if (buf.size() >= block_spill_chunk)
+        write_out();
+}
+
+/**
+ * @brief Writes the rest of commands out and frees the buffer
+ */
+void block_spill_t::finish()
+{
+    write_out();
+    std::string().swap(buf);
+}
+
+/**
+ * @brief Passes the file by chunks, as it is; safe to call from several threads at once
+ * @param fn called with every chunk; returns false to stop
+ * @return false if fn stopped reading
+ */
+bool block_spill_t::read_body(const std::function<bool(std::string_view)> &fn) const
+{
+    std::unique_ptr<char[]> chunk(new char[block_spill_chunk]);
+    for (uint64_t offset = 0; offset < size;)
+    {
+        auto n_read = ::pread(fd, chunk.get(), std::min<uint64_t>(block_spill_chunk, size - offset), offset);
+        if (n_read <= 0)
+        {
+            std::cerr << "dynamic block spill read error" << std::endl;
+            std::quick_exit(2);
+        }
+        offset += n_read;
+        if (!fn(std::string_view(chunk.get(), n_read)))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Passes the commands one by one; a command, split by chunks, is assembled
+ * @param fn called with every command; returns false to stop
+ * @return false if fn stopped reading
+ */
+bool block_spill_t::read_cmds(const std::function<bool(std::string_view)> &fn) const
+{
+    std::string pending; // an unfinished command with its length from the previous chunks
+    return read_body([&](std::string_view chunk)
+                     {
+                         while (true)
+                         {
+                             if (pending.size() < sizeof(uint32_t)) // the length
+                             {
+                                 if (chunk.empty())
+                                     break;
+                                 auto take = std::min(sizeof(uint32_t) - pending.size(), chunk.size());
+                                 pending.append(chunk.substr(0, take));
+                                 chunk.remove_prefix(take);
+                                 continue;
+                             }
+                             uint32_t length;
+                             std::memcpy(&length, pending.data(), sizeof(length));
+                             auto need = length - (pending.size() - sizeof(length));
+                             if (!need)
+                             {
+                                 if (!fn(std::string_view(pending).substr(sizeof(length))))
+                                     return false;
+                                 pending.clear();
+                                 continue;
+                             }
+                             if (chunk.empty())
+                                 break;
+                             if (pending.size() == sizeof(length) && chunk.size() >= length) // the whole command in the chunk
+                             {
+                                 if (!fn(chunk.substr(0, length)))
+                                     return false;
+                                 chunk.remove_prefix(length);
+                                 pending.clear();
+                                 continue;
+                             }
+                             auto take = std::min<size_t>(need, chunk.size());
+                             pending.append(chunk.substr(0, take));
+                             chunk.remove_prefix(take);
+                         }
+                         return true; });
+}
@@ -0,0 +1,237 @@
+/**
+ * @brief block_store.cpp - realizes binary indexed block store for 'async' library
+ */
+#include "block_store.h"
+#include "cmd_output.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unistd.h>
+
+/**
+ * @brief Appends a trivially copyable value to a byte buffer
+ */
+template <typename T>
+static void put(std::string &buf, const T &value)
+{
+    buf.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+/**
+ * @brief Creates data and index files of the store in the log directory
+ * @param log_dir Path for output files
+ * @return true if both files are open
+ */
+bool block_store_t::open(const std::string &log_dir)
+{
+    std::lock_guard g(mtx);
+    auto base = log_dir + "/blocks_" + std::to_string(getpid());
+    data.open(base + store_ext, std::ios::binary | std::ios::trunc);
+    index.open(base + index_ext, std::ios::binary | std::ios::trunc);
+    if (!data.is_open() || !index.is_open())
+        return false;
+
+    store_header_t header{};
+    std::memcpy(header.magic, store_magic, sizeof(header.magic));
+    header.wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+    header.mono_ns = cmd_block_t::mono_now_ns();
+    data.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    index.write(index_magic, sizeof(index_magic));
+    offset = sizeof(header);
+    last_ns = header.mono_ns;
+    return true;
+}
+
+/**
+ * @brief Writes the open chunk into index; unprotected, mtx must be held
+ */
+void block_store_t::close_chunk()
+{
+    if (!chunk_records)
+        return;
+    chunk.end = offset;
+    data.flush(); // an index entry never points past the written data
+    index.write(reinterpret_cast<const char *>(&chunk), sizeof(chunk));
+    index.flush();
+    chunk_records = 0;
+}
+
+/**
+ * @brief Serializes a block as a record and appends it to data file;
+ *        the record timestamp is the block forming time, raised if needed
+ *        to keep timestamps non-decreasing along the file.
+ *        A spilled block's file is the record body already: it is copied as is
+ * @param block The block to store
+ */
+void block_store_t::append(const cmd_block_t &block)
+{
+    std::lock_guard g(mtx);
+    if (!data.is_open())
+        return;
+
+    record_header_t rh{};
+    rh.n_cmds = block.spill ? block.spill->n_cmds() : block.cmds.size();
+    rh.handle = block.handle;
+    rh.seq = block.seq;
+    rh.mono_ns = last_ns = std::max(block.mono_ns, last_ns);
+
+    record.clear();
+    put(record, rh);
+    for (auto &c : block.cmds)
+    {
+        put(record, uint32_t(c.size()));
+        record.append(c);
+    }
+    uint32_t length = record.size() - sizeof(rh.length) + (block.spill ? block.spill->bytes() : 0);
+    std::memcpy(record.data(), &length, sizeof(length));
+
+    if (!chunk_records)
+    {
+        chunk.offset = offset;
+        chunk.first_ns = rh.mono_ns;
+        chunk.handle_mask = 0;
+    }
+    data.write(record.data(), record.size());
+    offset += record.size();
+    if (block.spill)
+    {
+        block.spill->read_body([this](std::string_view chunk)
+                               { return bool(data.write(chunk.data(), chunk.size())); });
+        offset += block.spill->bytes();
+    }
+    chunk.last_ns = rh.mono_ns;
+    chunk.handle_mask |= handle_bit(rh.handle);
+
+    if (++chunk_records == chunk_max_records || offset - chunk.offset >= chunk_max_bytes)
+        close_chunk();
+}
+
+/**
+ * @brief Indexes the open chunk and closes both files
+ */
+void block_store_t::close()
+{
+    std::lock_guard g(mtx);
+    if (!data.is_open())
+        return;
+    close_chunk();
+    data.close();
+    index.close();
+}
+
+/**
+ * @brief Opens a store data file and loads the whole sparse index
+ * @param store_path path to '.bst' file; the index is looked for aside
+ * @return true if the data file is a valid store
+ */
+bool block_store_reader_t::open(const std::string &store_path)
+{
+    data.open(store_path, std::ios::binary | std::ios::ate);
+    if (!data.is_open())
+        return false;
+    data_size = data.tellg();
+    data.seekg(0);
+    if (!data.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+        std::memcmp(header.magic, store_magic, sizeof(store_magic)))
+        return false;
+
+    // A missing or torn index is not an error: the unindexed tail is scanned
+    auto index_path = store_path.substr(0, store_path.rfind('.')) + index_ext;
+    std::ifstream index(index_path, std::ios::binary);
+    char magic[sizeof(index_magic)];
+    if (index.read(magic, sizeof(magic)) && !std::memcmp(magic, index_magic, sizeof(magic)))
+    {
+        index_entry_t entry;
+        while (index.read(reinterpret_cast<char *>(&entry), sizeof(entry)))
+            if (entry.end <= data_size)
+                entries.push_back(entry);
+    }
+    return true;
+}
+
+/**
+ * @brief Reads a record at given position and advances the position.
+ *        Counts and lengths from the file are checked against the record length before allocation,
+ *        so a corrupt or torn record ends the store instead of a huge allocation
+ * @return false at the end of data or on a torn or corrupt record
+ */
+bool block_store_reader_t::read_record(stored_block_t &block, uint64_t &pos)
+{
+    record_header_t rh;
+    if (pos + sizeof(rh) > data_size)
+        return false;
+    data.seekg(pos);
+    if (!data.read(reinterpret_cast<char *>(&rh), sizeof(rh)) ||
+        rh.length < sizeof(rh) - sizeof(rh.length) ||
+        pos + sizeof(rh.length) + rh.length > data_size)
+        return false;
+    uint64_t body = rh.length - (sizeof(rh) - sizeof(rh.length)); // bytes of the commands with their lengths
+    if (uint64_t(rh.n_cmds) * sizeof(uint32_t) > body)
+        return false;
+
+    block.handle = rh.handle;
+    block.seq = rh.seq;
+    block.mono_ns = rh.mono_ns;
+    block.cmds.resize(rh.n_cmds);
+    body -= uint64_t(rh.n_cmds) * sizeof(uint32_t);
+    for (auto &c : block.cmds)
+    {
+        uint32_t len;
+        if (!data.read(reinterpret_cast<char *>(&len), sizeof(len)) || len > body)
+            return false;
+        body -= len;
+        c.resize(len);
+        data.read(c.data(), len);
+    }
+    pos += sizeof(rh.length) + rh.length;
+    return bool(data);
+}
+
+/**
+ * @brief Reads records in [pos, end) and outputs those matching the query
+ */
+void block_store_reader_t::scan(uint64_t pos, uint64_t end, const store_query_t &q,
+                                const std::function<void(const stored_block_t &)> &out)
+{
+    stored_block_t block;
+    while (pos < end && read_record(block, pos))
+    {
+        if (block.mono_ns > q.to_ns)
+            break; // timestamps are non-decreasing along the file
+        if (block.mono_ns >= q.from_ns && (!q.by_handle || block.handle == q.handle))
+            out(block);
+    }
+}
+
+/**
+ * @brief Finds the first chunk which may contain matching records by binary search,
+ *        then reads only the chunks overlapping with the query
+ * @param q the query
+ * @param out receives found blocks
+ * @return nof blocks found
+ */
+size_t block_store_reader_t::query(const store_query_t &q,
+                                   const std::function<void(const stored_block_t &)> &out)
+{
+    size_t found = 0;
+    auto counting_out = [&](const stored_block_t &b)
+    {
+        ++found;
+        out(b);
+    };
+
+    auto p = std::partition_point(entries.begin(), entries.end(),
+                                  [&](const index_entry_t &e)
+                                  { return e.last_ns < q.from_ns; });
+    for (; p != entries.end() && p->first_ns <= q.to_ns; ++p)
+        if (!q.by_handle || (p->handle_mask & handle_bit(q.handle)))
+            scan(p->offset, p->end, q, counting_out);
+
+    // Records after the last indexed chunk
+    uint64_t tail = entries.empty() ? sizeof(store_header_t) : entries.back().end;
+    if (p == entries.end() && tail < data_size)
+        scan(tail, data_size, q, counting_out);
+    return found;
+}
@@ -0,0 +1,181 @@
+/**
+ * @brief capture.cpp - realizes capture of producers' traffic for 'async' library
+ */
+#include "capture.h"
+#include <chrono>
+#include <cstring>
+
+/**
+ * @brief Records are written to the file by chunks of this size
+ */
+constexpr size_t capture_chunk_bytes = 64 * 1024;
+
+/**
+ * @brief Monotonic clock in ns
+ */
+static uint64_t steady_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+/**
+ * @brief Appends an unsigned LEB128 varint to a byte buffer
+ */
+static void put_varint(std::string &buf, uint64_t value)
+{
+    for (; value >= 0x80; value >>= 7)
+        buf.push_back(static_cast<char>(value | 0x80));
+    buf.push_back(static_cast<char>(value));
+}
+
+/**
+ * @brief Creates the capture and writes its header
+ * @param path capture file path
+ * @param block_size block size of the captured instance
+ * @return true if the capture is open
+ */
+bool capture_writer_t::open(const std::string &path, size_t block_size)
+{
+    std::lock_guard g(mtx);
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+        return false;
+
+    capture_header_t header{};
+    std::memcpy(header.magic, capture_magic, sizeof(header.magic));
+    header.wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+    header.block_size = block_size;
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    start_ns = steady_ns();
+    return true;
+}
+
+/**
+ * @brief Appends a record to the buffer and writes the buffer by chunks; mtx must be held
+ */
+void capture_writer_t::put(capture_record_t::type_t type, edit::connection_handle_t handle, std::string_view data)
+{
+    if (!file.is_open())
+        return;
+    auto now = steady_ns() - start_ns;
+    put_varint(buf, now - last_ns);
+    last_ns = now;
+    put_varint(buf, handle);
+    buf.push_back(static_cast<char>(type));
+    if (type == capture_record_t::Data)
+    {
+        put_varint(buf, data.size());
+        buf.append(data);
+    }
+    if (buf.size() >= capture_chunk_bytes)
+    {
+        file.write(buf.data(), buf.size());
+        buf.clear();
+    }
+}
+
+/**
+ * @brief Records a new connection
+ */
+void capture_writer_t::connect(edit::connection_handle_t handle)
+{
+    std::lock_guard g(mtx);
+    put(capture_record_t::Connect, handle, {});
+}
+
+/**
+ * @brief Records bytes read from a connection
+ */
+void capture_writer_t::data(edit::connection_handle_t handle, std::string_view bytes)
+{
+    std::lock_guard g(mtx);
+    put(capture_record_t::Data, handle, bytes);
+}
+
+/**
+ * @brief Records a closed connection
+ */
+void capture_writer_t::disconnect(edit::connection_handle_t handle)
+{
+    std::lock_guard g(mtx);
+    put(capture_record_t::Disconnect, handle, {});
+}
+
+/**
+ * @brief Writes the rest of records and closes the capture
+ */
+void capture_writer_t::close()
+{
+    std::lock_guard g(mtx);
+    if (!file.is_open())
+        return;
+    file.write(buf.data(), buf.size());
+    buf.clear();
+    file.close();
+}
+
+/**
+ * @brief Opens a capture and checks its header
+ * @param path capture file path
+ * @return true if it is a capture
+ */
+bool capture_reader_t::open(const std::string &path)
+{
+    file.open(path, std::ios::binary);
+    return file.is_open() &&
+           file.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+           !std::memcmp(header.magic, capture_magic, sizeof(capture_magic));
+}
+
+/**
+ * @brief Reads an unsigned LEB128 varint
+ * @return false at the end of the file
+ */
+bool capture_reader_t::get_varint(uint64_t &value)
+{
+    value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7)
+    {
+        auto c = file.get();
+        if (c == std::ifstream::traits_type::eof())
+            return false;
+        value |= uint64_t(c & 0x7f) << shift;
+        if (!(c & 0x80))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Reads the next record
+ * @param record the record read
+ * @return false at the end of the capture or at a truncated record
+ */
+bool capture_reader_t::next(capture_record_t &record)
+{
+    uint64_t delta, handle, length;
+    if (!get_varint(delta) || !get_varint(handle))
+        return false;
+    auto type = file.get();
+    if (type < capture_record_t::Connect || type > capture_record_t::Disconnect)
+        return false;
+
+    last_ns += delta;
+    record.time_ns = last_ns;
+    record.handle = handle;
+    record.type = static_cast<capture_record_t::type_t>(type);
+    record.data.clear();
+    if (record.type == capture_record_t::Data)
+    {
+        if (!get_varint(length))
+            return false;
+        record.data.resize(length);
+        if (!file.read(record.data.data(), length))
+            return false;
+    }
+    return true;
+}
@@ -4,32 +4,57 @@
 #include "async_internal.h"
 #include "cmd_output.h"
 #include "common.h"
+#include <algorithm>
 #include <iostream>
-#include <fstream>
 #include <thread>
 #include <mutex>
-#include <cassert>
 #include <memory>
 
 /**
- * @brief Lazy launch of output threads
- * @param log_dir Path for output files
+ * @brief Creates the built-in sinks of an instance: console, file and, if configured, TCP forwarder;
+ *        a sink with no workers is off
+ * @param options instance parameters
+ * @param journal the instance's journal
  */
-void out_threadpool_t::try_to_launch(const char *log_dir)
+output_context_t::output_context_t(const options_t &options, journal_t &journal)
+    : blocks_q(journal, std::chrono::microseconds(options.spin_us), options.fair, options.log_dir, options.inline_output),
+      static_cmds(options.block_size, blocks_q)
 {
-
-    std::lock_guard tread_lock(output_context()->th_pool.mtx);
-    if (!output_context()->th_pool.threads_started)
+    if (options.console.workers)
+        blocks_q.add(std::make_unique<console_sink_t>(), options.console, options.log_dir);
+    if (options.file.workers)
+        blocks_q.add(std::make_unique<file_sink_t>(options.file_format, options.log_dir), options.file, options.log_dir);
+    if (options.forward && options.forwarder.workers)
     {
-        output_context()->th_pool.log_dir = log_dir;
-        output_context()->th_pool.pool.emplace_back(std::thread(thread_to_console)).detach();
-        output_context()->th_pool.pool.emplace_back(std::thread(thread_to_file)).detach();
-        output_context()->th_pool.pool.emplace_back(std::thread(thread_to_file)).detach();
-
-        output_context()->th_pool.threads_started = true;
+        std::string address(options.forward);
+        auto colon = address.rfind(':');
+        if (colon == std::string::npos)
+        {
+            std::cerr << "forward address must be <ip address>:<port>" << std::endl;
+            std::quick_exit(2);
+        }
+        blocks_q.add(std::make_unique<tcp_sink_t>(address.substr(0, colon), std::atoi(address.c_str() + colon + 1)),
+                     options.forwarder, options.log_dir);
     }
 }
 
+/**
+ * @brief Lazy launch of sinks' threads
+ */
+void output_context_t::try_to_launch()
+{
+    std::call_once(launched, [this]()
+                   { blocks_q.launch(); });
+}
+
+/**
+ * @brief Outputs the rest of blocks and joins sinks' threads
+ */
+void output_context_t::stop()
+{
+    blocks_q.stop();
+}
+
 /**
  * @brief Inprotectedly writes a block of cmd's to a stream
  * @param block The block to output
@@ -37,6 +62,12 @@ void out_threadpool_t::try_to_launch(const char *log_dir)
  */
 void write_block_to_stream(const cmd_block_t &block, std::ostream &stream)
 {
+    if (block.spill)
+    {
+        format_spilled_block(block, [&stream](std::string_view piece)
+                             { return bool(stream.write(piece.data(), piece.size())); });
+        return;
+    }
 
     std::string ss("block: ");
     bool start = true;
@@ -53,141 +84,193 @@ void write_block_to_stream(const cmd_block_t &block, std::ostream &stream)
 }
 
 /**
- * @brief Output several command blocks to console at a time
+ * @brief Creates the queue; with fair scheduling, its dispatcher fans blocks out.
+ *        Inline output has no queueing, so it goes without fair scheduling
+ * @param _journal the instance's journal
+ * @param _spin sinks' and dispatcher's threads spin so long before sleeping
+ * @param fair_options fair scheduling parameters
+ * @param spill_dir directory for spill files of the fair queue's flows
+ * @param _inline_batch inline output: blocks per batch, written by the pushing thread; 0 - the sinks' own threads
  */
-void thread_to_console()
+cmd_blocks_q_t::cmd_blocks_q_t(journal_t &_journal, std::chrono::microseconds _spin, const fair_options_t &fair_options,
+                               const std::string &spill_dir, size_t _inline_batch)
+    : journal(_journal), spin(_spin), inline_batch(_inline_batch)
 {
-
-    std::vector<cmd_block_t> blocks;
-    while (output_context()->blocks_q.fetch_blocks<TO_CONS>(blocks))
-    {
-        for (auto pblock = blocks.begin(); pblock != blocks.end(); ++pblock)
-            if (pblock->cmds.size())
-                write_block_to_stream(*pblock, std::cout);
-        blocks.clear();
-    }
+    if (fair_options.enabled && !inline_batch)
+        fair = std::make_unique<fair_q_t>(
+            fair_options, [this](std::unique_ptr<cmd_block_t> block)
+            { fan_out(std::move(block)); },
+            [this, credit = std::max<size_t>(fair_options.sink_credit, 1)]()
+            { pace(credit); },
+            spill_dir, spin);
 }
 
 /**
- * @brief Output several command blocks to file at a time
+ * @brief Formats a spilled block as a 'block: ...' line by pieces: the commands are read back
+ *        from the spill file by chunks, so a huge block is never in memory at once
+ * @param block the block with a spill file
+ * @param out called with every piece of the line; returns false to stop
+ * @return false if out stopped the output
  */
-void thread_to_file()
+bool format_spilled_block(const cmd_block_t &block, const std::function<bool(std::string_view)> &out)
 {
-    std::vector<cmd_block_t> blocks;
-    while (output_context()->blocks_q.fetch_blocks<TO_FILE>(blocks))
-    {
-        for (auto pblock = blocks.begin(); pblock != blocks.end(); ++pblock)
-        {
-            if (pblock->cmds.size())
-            {
-                std::string path = std::string(log_directory)          //
-                                   + std::string("/bulk")              //
-                                   + std::to_string(pblock->timestamp) //
-                                   + std::string("_")                  //
-                                   + this_pid_to_string()              //
-                                   + std::string(".log");
-                try
-                {
-                    // Lock to prepare next operation with non- empty cmd q
-                    std::ofstream _file(path);
-                    assert(_file.is_open());
-
-                    write_block_to_stream(*pblock, _file);
-                }
-                catch (const std::exception &e)
-                {
-                    std::cerr << "file write error" << std::endl;
-                    std::quick_exit(2);
-                }
-            }
-        }
-        blocks.clear();
-    }
+    std::string piece("block: ");
+    bool start = true;
+    bool ok = block.spill->read_cmds([&](std::string_view cmd)
+                                     {
+                                         if (!start)
+                                             piece += ", ";
+                                         start = false;
+                                         piece += cmd;
+                                         if (piece.size() < block_spill_chunk)
+                                             return true;
+                                         bool more = out(piece);
+                                         piece.clear();
+                                         return more; });
+    piece += "\n";
+    return ok && out(piece);
 }
 
 /**
- * @brief Erases already output blocks from queue
- *        and pushs a new block into queue
- * @param cmds Block of commands to push
+ * @brief Registers a sink; in inline output mode, a remote sink gets its own threads anyway:
+ *        its writes wait for an unreachable peer, which must not hold the thread forming blocks
+ * @param sink the sink
+ * @param options workers, buffer limit, overflow policy
+ * @param spill_dir directory for the sink's spill file
  */
-void cmd_blocks_q_t::erase_push(cmds_t &cmds)
+void cmd_blocks_q_t::add(std::unique_ptr<sink_t> sink, const sink_options_t &options, const std::string &spill_dir)
 {
-    // Erase blocks from queue
-    std::unique_lock lock(common_mtx);
-    for (auto p = lst.begin(); p != lst.end(); ++p)
-    {
-        if (p->output_state.load() == (TO_FILE::value | TO_CONS::value))
-        {
-            lst.erase(p); // pop from queue
-            break;
-        }
-    }
+    std::lock_guard g(mtx);
+    auto batch = sink->remote() ? 0 : inline_batch;
+    sinks.emplace_back(std::make_unique<sink_runner_t>(std::move(sink), options, spill_dir, spin, batch));
+}
 
-    if (!cmds.size())
+/**
+ * @brief Inline output mode: writes the sinks' partial batches; called by a thread forming blocks,
+ *        when it has nothing more to do, so a batch does not wait for the next blocks
+ */
+void cmd_blocks_q_t::flush_inline()
+{
+    if (!inline_batch)
         return;
-
-    // Push new block to queue
-    lst.emplace_back(cmds); // timestamp is set in constructor
-    cmds.clear();
-
-    cv.notify_all();
+    std::lock_guard g(mtx);
+    for (auto &sink : sinks)
+        sink->flush_inline();
 }
 
 /**
- * @brief  Empty template to use with console output
- * @tparam T
- * @param fl std::unique_lock to lock
+ * @brief Opens the sinks and launches their threads
  */
-template <typename T>
-void filelock([[maybe_unused]] std::unique_lock<std::mutex> &fl) {}
+void cmd_blocks_q_t::launch()
+{
+    std::lock_guard g(mtx);
+    for (auto &sink : sinks)
+        sink->launch();
+    if (fair)
+        fair->launch();
+}
 
 /**
- * @brief Specialized working template to use with file output
- * @tparam
- * @param fl std::unique_lock to lock
+ * @brief Pushs a new block to every sink, or to the fair queue, which fans it out in its turn
+ * @param cmds Block of commands to push, cleared
+ * @param lsns journal LSNs of the commands, cleared
+ * @param handle Connection the block came from, or static_handle
+ * @param spill commands of an oversized dynamic block instead of cmds, or nullptr
  */
-template <TO_FILE>
-void filelock(std::unique_lock<std::mutex> &fl)
+void cmd_blocks_q_t::push(cmds_t &cmds, lsns_t &lsns, connection_handle_t handle, std::unique_ptr<block_spill_t> spill)
 {
-    fl.lock();
+    if (!cmds.size() && !spill)
+    {
+        journal.forget(lsns); // brackets of an empty dynamic block
+        lsns.clear();
+        return;
+    }
+
+    if (spill)
+        spill->finish();
+    std::unique_ptr<cmd_block_t> block(new cmd_block_t(std::move(cmds), std::move(lsns), handle, 0, std::move(spill)));
+    cmds.clear();
+    lsns.clear();
+    if (fair)
+        fair->push(std::move(block));
+    else
+        fan_out(std::move(block));
 }
 
 /**
- * @brief Copy ready-to-be-written blocks for output them
- *        and establishes their output states in queue
- * @tparam T     - TO_FILE or TO_CONS
- * @param blocks a place where to copy found blocks
- * @return       true if the queue is still worth to be processed
+ * @brief Pushes a connection's dynamic block, in memory or spilled, and clears it in the context
+ * @param ctx input context of the connection
+ * @param handle the connection
  */
-template <typename T>
-bool cmd_blocks_q_t::fetch_blocks(std::vector<cmd_block_t> &blocks)
+void cmd_blocks_q_t::push(input_context_t &ctx, connection_handle_t handle)
 {
+    push(ctx.dyna_cmds, ctx.dyna_lsns, handle, std::move(ctx.dyna_spill));
+    ctx.dyna_bytes = 0;
+}
 
-    std::shared_lock<std::shared_mutex> shared_lock(common_mtx);
-    cv.wait(shared_lock,
-            []()
-            {
-                if (!output_context()->blocks_q.lst.empty())
-                    return true;
-                return false;
-            });
-    if (!lst.empty())
+/**
+ * @brief Numbers a block and pushes it to every sink; a journaled block is journaled as done,
+ *        when the last sink has written it (see journal_countdown_t). The sinks get blocks under mtx,
+ *        so all of them get blocks in the same order; a sink with a full buffer holds the producer back
+ *        after mtx is released, so the other sinks and producers go on. In inline output mode,
+ *        the sinks write blocks under mtx
+ * @param block the block
+ */
+void cmd_blocks_q_t::fan_out(std::unique_ptr<cmd_block_t> block)
+{
     {
-        for (auto p_block = lst.begin(); p_block != lst.end(); p_block++)
+        std::lock_guard g(mtx);
+        block->seq = next_seq++;
+        if (!block->lsns.empty())
         {
-            std::unique_lock fl(file_mtx, std::defer_lock);
-            filelock<T>(fl);
+            if (sinks.empty())
+            {
+                journal.done(block->seq, block->lsns);
+                return;
+            }
+            block->countdown = std::make_shared<journal_countdown_t>(sinks.size(), journal);
+        }
+        sp_block_t shared(std::move(block));
+        for (auto &sink : sinks)
+            sink->push(shared);
+    }
+    for (auto &sink : sinks) // added before output starts only
+        sink->wait_room();
+}
 
-            auto cur_state = p_block->output_state.load();
-            if (cur_state & T::value)
-                continue; //
-            p_block->output_state.store(cur_state |= T::value);
+/**
+ * @brief Fair scheduling: waits until every 'block' sink has taken all but credit blocks; the slowest
+ *        of them paces the dispatch. 'drop' and 'spill' sinks are not waited for, so a slow console
+ *        or an unreachable aggregator does not stop the dispatch to the others
+ * @param credit max nof blocks left to a sink
+ */
+void cmd_blocks_q_t::pace(size_t credit)
+{
+    for (auto &sink : sinks) // added before output starts only
+        sink->wait_credit(credit);
+}
 
-            blocks.emplace_back(*p_block); // copy block
-            break;
-        }
+/**
+ * @brief Outputs the rest of blocks and joins sinks' threads
+ */
+void cmd_blocks_q_t::stop()
+{
+    if (fair)
+    {
+        for (auto &sink : sinks)
+            sink->end_pacing();
+        fair->stop(); // the rest of blocks go to the sinks
     }
-    shared_lock.unlock();
-    cv.notify_all();
-    return true;
+    std::lock_guard g(mtx);
+    for (auto &sink : sinks)
+        sink->stop();
+}
+
+/**
+ * @brief Fairness metrics of the fair queue since the previous call
+ * @return the metrics; zeros if fair scheduling is off
+ */
+fairness_stats_t cmd_blocks_q_t::fairness()
+{
+    return fair ? fair->stats() : fairness_stats_t{};
 }
@@ -0,0 +1,285 @@
+/**
+ * @brief fair_queue.cpp - realizes fair scheduling of formed blocks for 'async' library
+ */
+#include "fair_queue.h"
+#include "cmd_output.h"
+#include "common.h"
+#include "spin_wait.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <string>
+
+/**
+ * @brief Bytes of a block's commands: the cost of the block in deficit round-robin
+ */
+static size_t block_bytes(const cmd_block_t &block)
+{
+    size_t bytes = 0;
+    for (auto &cmd : block.cmds)
+        bytes += cmd.size();
+    if (block.spill)
+        bytes += block.spill->bytes();
+    return std::max<size_t>(bytes, 1);
+}
+
+/**
+ * @brief Appends a block to the flow's spill file, as sink_runner_t does; mtx must be held.
+ *        The file is opened on the flow's first overflow and unlinked at once: one file per flow
+ *        however many blocks it holds, gone with the flow or the process
+ * @return false if the file can't be opened: the block stays in memory
+ */
+bool fair_q_t::spill_block(connection_handle_t ch, flow_t &flow, const cmd_block_t &block)
+{
+    if (!flow.spill)
+    {
+        auto path = spill_dir + "/spill_fair_" + std::to_string(ch) + "_" + this_pid_to_string() + ".tmp";
+        flow.spill = std::make_unique<std::fstream>(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        std::remove(path.c_str());
+        if (!flow.spill->is_open())
+        {
+            flow.spill.reset();
+            return false;
+        }
+    }
+    auto &spill = *flow.spill;
+    auto put = [&spill](const auto &value)
+    { spill.write(reinterpret_cast<const char *>(&value), sizeof(value)); };
+
+    spill.seekp(0, std::ios::end);
+    put(block.timestamp);
+    put(block.mono_ns);
+    put(static_cast<uint32_t>(block.cmds.size()));
+    for (auto &cmd : block.cmds)
+    {
+        auto text = cmd.view();
+        put(static_cast<uint32_t>(text.size()));
+        spill.write(text.data(), text.size());
+    }
+    put(static_cast<uint32_t>(block.lsns.size()));
+    spill.write(reinterpret_cast<const char *>(block.lsns.data()), block.lsns.size() * sizeof(uint64_t));
+    if (!spill)
+    {
+        std::cerr << "fair queue spill write error" << std::endl;
+        std::quick_exit(2);
+    }
+    ++flow.spilled;
+    return true;
+}
+
+/**
+ * @brief Reads the flow's oldest spilled block; truncates the spill file, once it is read out. mtx must be held
+ */
+std::unique_ptr<cmd_block_t> fair_q_t::unspill_block(flow_t &flow)
+{
+    auto &spill = *flow.spill;
+    auto block = std::make_unique<cmd_block_t>();
+    auto get = [&spill](auto &value)
+    { spill.read(reinterpret_cast<char *>(&value), sizeof(value)); };
+
+    spill.seekg(flow.spill_read);
+    get(block->timestamp);
+    get(block->mono_ns);
+    uint32_t n;
+    get(n);
+    block->cmds.reserve(n);
+    std::string text;
+    for (uint32_t i = n; i--;)
+    {
+        get(n);
+        text.resize(n);
+        spill.read(text.data(), n);
+        block->cmds.emplace_back(text); // spilled blocks come back with own texts, not interned
+    }
+    get(n);
+    block->lsns.resize(n);
+    spill.read(reinterpret_cast<char *>(block->lsns.data()), n * sizeof(uint64_t));
+    if (!spill)
+    {
+        std::cerr << "fair queue spill read error" << std::endl;
+        std::quick_exit(2);
+    }
+    flow.spill_read = spill.tellg();
+    if (!--flow.spilled) // read out: the next overflow starts a new file
+    {
+        flow.spill.reset();
+        flow.spill_read = 0;
+    }
+    return block;
+}
+
+/**
+ * @brief Queues a block into its connection's flow. The producer never waits here, it is the ingress
+ *        or the collector thread, shared by all the connections: when the flow holds flow_limit bytes
+ *        in memory or more, the block goes to the flow's spill file, so a bulk producer's backlog
+ *        goes to disk, and the others are not held back
+ * @param block the block
+ */
+void fair_q_t::push(std::unique_ptr<cmd_block_t> block)
+{
+    auto ch = block->handle;
+    auto bytes = block_bytes(*block);
+    std::unique_lock lock(mtx);
+    auto &flow = flows[ch];
+    if (flow.q.empty())
+        active.push_back(ch);
+    auto memory = block->spill ? 0 : bytes; // a block with its own spill file is kept as is
+    if (memory && flow.memory_bytes >= options.flow_limit && spill_block(ch, flow, *block))
+    {
+        block.reset();
+        memory = 0;
+        ++spilled;
+    }
+    flow.q.push_back(queued_t{std::move(block), bytes, memory, cmd_block_t::mono_now_ns()});
+    flow.memory_bytes += memory;
+    ++queued_blocks;
+    queued_bytes += bytes;
+    lock.unlock();
+    ready_cv.notify_one();
+}
+
+/**
+ * @brief The dispatcher thread: takes the flow at the head of the round, adds its quantum to its deficit
+ *        and dispatches its blocks while the deficit covers them; a flow with blocks left goes to the tail.
+ *        Before a turn, it waits for the sinks' credit: with the blocks waiting here, not in the sinks' buffers,
+ *        the round-robin decides the output order. Blocks are handed over to the sinks out of the lock,
+ *        so producers are not held by a slow sink
+ */
+void fair_q_t::run()
+{
+    std::vector<std::unique_ptr<cmd_block_t>> batch;
+    std::unique_lock lock(mtx);
+    while (true)
+    {
+        spin_wait(lock, ready_cv, spin, [this]()
+                  { return !active.empty() || stopping; });
+        if (active.empty())
+            return; // stopping, nothing is left
+        if (!stopping)
+        {
+            lock.unlock();
+            pace();
+            lock.lock();
+        }
+
+        auto ch = active.front();
+        active.pop_front();
+        auto it = flows.find(ch);
+        auto &flow = it->second;
+        flow.deficit += quantum_of(ch);
+        if (active.empty()) // no one to share with: no idle rounds for a block bigger than the quantum
+            flow.deficit = std::max(flow.deficit, flow.q.front().bytes);
+        auto now = cmd_block_t::mono_now_ns();
+        while (!flow.q.empty() && flow.q.front().bytes <= flow.deficit)
+        {
+            auto &front = flow.q.front();
+            flow.deficit -= front.bytes;
+            flow.memory_bytes -= front.memory;
+            flow.served_bytes += front.bytes;
+            --queued_blocks;
+            queued_bytes -= front.bytes;
+            auto wait = now - front.queued_ns;
+            auto cls = ch == static_handle ? 0 : 1;
+            max_wait_ns[cls] = std::max(max_wait_ns[cls], wait);
+            sum_wait_ns[cls] += wait;
+            ++n_waits[cls];
+            batch.push_back(front.block ? std::move(front.block) : unspill_block(flow));
+            batch.back()->handle = ch;
+            flow.q.pop_front();
+        }
+        if (!flow.q.empty())
+        {
+            flow.backlogged = true;
+            active.push_back(ch);
+        }
+        else // the flow's busy period is over: its share is counted, the flow is forgotten
+        {
+            if (flow.backlogged)
+            {
+                auto served = double(flow.served_bytes);
+                ++n_periods;
+                sum_served += served;
+                sum_served_sq += served * served;
+            }
+            flows.erase(it);
+        }
+        if (batch.empty())
+            continue;
+
+        lock.unlock();
+        for (auto &block : batch)
+            dispatch(std::move(block));
+        lock.lock();
+        dispatched += batch.size();
+        batch.clear();
+    }
+}
+
+/**
+ * @brief Launches the dispatcher
+ */
+void fair_q_t::launch()
+{
+    dispatcher = std::thread(&fair_q_t::run, this);
+}
+
+/**
+ * @brief Dispatches the rest of blocks and joins the dispatcher
+ */
+void fair_q_t::stop()
+{
+    {
+        std::lock_guard g(mtx);
+        stopping = true;
+    }
+    ready_cv.notify_all();
+    if (dispatcher.joinable())
+        dispatcher.join();
+}
+
+/**
+ * @brief Fairness metrics since the previous call. Jain's index is (sum x)^2 / (n * sum x^2)
+ *        over bytes x, served to a flow in each of n busy periods; flows still busy count with their bytes so far.
+ *        Only backlogged flows count: a flow, which got all it asked for, had no less than its share
+ * @return the metrics
+ */
+fairness_stats_t fair_q_t::stats()
+{
+    std::lock_guard g(mtx);
+    fairness_stats_t stats;
+    stats.flows = active.size();
+    stats.queued_blocks = queued_blocks;
+    stats.queued_bytes = queued_bytes;
+    stats.dispatched = dispatched;
+    stats.spilled = spilled;
+
+    auto n = double(n_periods), sum = sum_served, sum_sq = sum_served_sq;
+    for (auto &[_, flow] : flows)
+    {
+        auto served = double(flow.served_bytes);
+        if (!served || !flow.backlogged)
+            continue;
+        n += 1;
+        sum += served;
+        sum_sq += served * served;
+        flow.served_bytes = 0;
+    }
+    if (sum_sq > 0)
+        stats.jain_index = sum * sum / (n * sum_sq);
+
+    stats.static_max_wait_us = max_wait_ns[0] / 1000.0;
+    stats.dynamic_max_wait_us = max_wait_ns[1] / 1000.0;
+    if (n_waits[0])
+        stats.static_mean_wait_us = sum_wait_ns[0] / 1000.0 / n_waits[0];
+    if (n_waits[1])
+        stats.dynamic_mean_wait_us = sum_wait_ns[1] / 1000.0 / n_waits[1];
+
+    dispatched = 0;
+    spilled = 0;
+    n_periods = 0;
+    sum_served = sum_served_sq = 0;
+    std::fill(std::begin(max_wait_ns), std::end(max_wait_ns), 0);
+    std::fill(std::begin(sum_wait_ns), std::end(sum_wait_ns), 0);
+    std::fill(std::begin(n_waits), std::end(n_waits), 0);
+    return stats;
+}
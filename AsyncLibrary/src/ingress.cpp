@@ -0,0 +1,124 @@
+/**
+ * @brief ingress.cpp - realizes non-blocking ingress queue for 'async' library
+ */
+#include "ingress.h"
+#include "spin_wait.h"
+#include <utility>
+
+/**
+ * @brief Accepts an operation into the queue, or parks it if the queue is full;
+ *        the operation's 'on_accepted' is called on acceptance:
+ *        at once on the caller's thread, or later on the ingress thread.
+ *        An operation without 'on_accepted' is never parked: its caller waits for room,
+ *        as it waits for the library's locks without the ingress queue. A caller with 'on_accepted'
+ *        never waits: it awaits acceptance, so it has one parked operation at most.
+ *        Must not be called on the ingress thread
+ * @param op operation to post
+ */
+void ingress_q_t::post(ingress_op_t op)
+{
+    accept_callback_t on_accepted;
+    {
+        std::unique_lock lock(mtx);
+        if (!started)
+        {
+            worker = std::thread(&ingress_q_t::run, this);
+            started = true;
+        }
+
+        // Parked operations go first, so that the posting order is kept
+        auto fits = [this, &op]()
+        { return parked.empty() && (!accepted_weight || accepted_weight + op.weight() <= ingress_capacity); };
+        if (!op.on_accepted)
+            room_cv.wait(lock, fits);
+        else if (!fits()) // the ingress thread is busy, so it admits parked operations, when it is done
+        {
+            parked.emplace_back(std::move(op));
+            return;
+        }
+        accepted_weight += op.weight();
+        on_accepted = std::move(op.on_accepted);
+        ops.emplace_back(std::move(op));
+    }
+    cv.notify_one();
+    if (on_accepted)
+        on_accepted();
+}
+
+/**
+ * @brief The ingress thread: takes accepted operations batch-by-batch,
+ *        applies them and admits parked operations into freed room
+ */
+void ingress_q_t::run()
+{
+    std::vector<ingress_op_t> batch;
+    std::vector<accept_callback_t> admitted;
+    while (true)
+    {
+        {
+            std::unique_lock lock(mtx);
+            busy = false;
+            if (ops.empty() && parked.empty())
+                idle_cv.notify_all();
+            spin_wait(lock, cv, spin, [this]()
+                      { return !ops.empty() || stopping; });
+            if (ops.empty())
+                return; // stopping, and parked operations are always admitted into 'ops' first
+            batch.swap(ops);
+            busy = true;
+        }
+
+        for (auto &op : batch)
+            apply(op);
+
+        bool drained;
+        {
+            std::lock_guard g(mtx);
+            for (auto &op : batch)
+                accepted_weight -= op.weight();
+            while (!parked.empty() &&
+                   (!accepted_weight || accepted_weight + parked.front().weight() <= ingress_capacity))
+            {
+                accepted_weight += parked.front().weight();
+                admitted.emplace_back(std::move(parked.front().on_accepted));
+                ops.emplace_back(std::move(parked.front()));
+                parked.pop_front();
+            }
+            drained = ops.empty();
+        }
+        batch.clear();
+        room_cv.notify_all();
+
+        for (auto &on_accepted : admitted)
+            if (on_accepted)
+                on_accepted();
+        admitted.clear();
+        if (drained && idle)
+            idle();
+    }
+}
+
+/**
+ * @brief Waits until all the posted operations are applied
+ */
+void ingress_q_t::flush()
+{
+    std::unique_lock lock(mtx);
+    idle_cv.wait(lock, [this]()
+                 { return !started || (ops.empty() && parked.empty() && !busy); });
+}
+
+/**
+ * @brief Applies posted operations and joins the ingress thread
+ */
+void ingress_q_t::stop()
+{
+    flush();
+    {
+        std::lock_guard g(mtx);
+        stopping = true;
+    }
+    cv.notify_one();
+    if (worker.joinable())
+        worker.join();
+}
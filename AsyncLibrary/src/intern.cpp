@@ -0,0 +1,109 @@
+/**
+ * @brief intern.cpp - realizes the bounded concurrent intern table of 'async' library
+ */
+#include "intern.h"
+#include <algorithm>
+#include <functional>
+
+/**
+ * @brief Creates the table
+ * @param capacity max nof entries; 0 - interning is off
+ * @param _max_length longer commands are not interned: they are unlikely to repeat
+ */
+intern_table_t::intern_table_t(size_t capacity, size_t _max_length) : max_length(_max_length)
+{
+    if (!capacity)
+        return;
+    shards = std::make_unique<shard_t[]>(n_shards);
+    shard_capacity = std::max<size_t>(capacity / n_shards, 1);
+}
+
+/**
+ * @brief Releases the table's references; nodes, which are still in blocks, live on
+ */
+intern_table_t::~intern_table_t()
+{
+    if (!shards)
+        return;
+    for (size_t i = 0; i < n_shards; ++i)
+        for (auto node : shards[i].clock)
+            node->release();
+}
+
+/**
+ * @brief A command for a text: an inline one for a short text, the table's shared node for a text,
+ *        which is in the table or added to it, an own node if interning is off or the text is too long
+ * @param text command text
+ * @return the command
+ */
+cmd_t intern_table_t::intern(std::string_view text)
+{
+    if (!shards || text.size() <= cmd_t::inline_size || text.size() > max_length)
+        return cmd_t(text);
+
+    auto hash = std::hash<std::string_view>{}(text);
+    auto &shard = shards[hash % n_shards];
+    std::lock_guard g(shard.mtx);
+    auto it = shard.map.find(text);
+    if (it != shard.map.end())
+    {
+        it->second.hit = true;
+        it->second.node->add_ref();
+        n_hits.fetch_add(1, std::memory_order_relaxed);
+        return cmd_t(it->second.node);
+    }
+    if (shard.map.size() >= shard_capacity)
+        evict(shard);
+    auto node = cmd_text_t::make(text, 2); // the table's and the command's references
+    shard.map.emplace(node->view(), entry_t{node, false});
+    shard.clock.push_back(node);
+    shard.bytes += text.size();
+    n_misses.fetch_add(1, std::memory_order_relaxed);
+    return cmd_t(node);
+}
+
+/**
+ * @brief Evicts the first entry, which was not looked up since the clock hand passed it;
+ *        the passed ones get a second chance at the clock's tail. mtx is held
+ * @param shard the shard
+ */
+void intern_table_t::evict(shard_t &shard)
+{
+    while (true)
+    {
+        auto node = shard.clock.front();
+        shard.clock.pop_front();
+        auto &entry = shard.map.at(node->view());
+        if (entry.hit)
+        {
+            entry.hit = false;
+            shard.clock.push_back(node);
+            continue;
+        }
+        shard.map.erase(node->view());
+        shard.bytes -= node->size;
+        node->release();
+        n_evictions.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+}
+
+/**
+ * @brief Statistics of the table
+ * @return entries, their bytes, hits, misses, evictions
+ */
+edit::intern_stats_t intern_table_t::stats() const
+{
+    edit::intern_stats_t stats;
+    if (shards)
+        for (size_t i = 0; i < n_shards; ++i)
+        {
+            std::lock_guard g(shards[i].mtx);
+            stats.entries += shards[i].map.size();
+            stats.bytes += shards[i].bytes;
+        }
+    stats.hits = n_hits.load(std::memory_order_relaxed);
+    stats.misses = n_misses.load(std::memory_order_relaxed);
+    stats.evictions = n_evictions.load(std::memory_order_relaxed);
+    return stats;
+}
@@ -0,0 +1,356 @@
+/**
+ * @brief journal.cpp - realizes write-ahead journal of 'async' library
+ */
+#include "journal.h"
+#include "cmd_output.h"
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @brief FNV-1a checksum of a record payload
+ */
+static uint32_t checksum(const void *data, size_t length)
+{
+    uint32_t h = 2166136261u;
+    for (auto p = static_cast<const unsigned char *>(data); length--; ++p)
+        h = (h ^ *p) * 16777619u;
+    return h;
+}
+
+/**
+ * @brief Creates a new journal; the previous one, if any, is kept for replay.
+ *        If a replay was interrupted, the journal written during it holds
+ *        replayed commands only and is dropped, the replay is repeated
+ * @param _path journal file path
+ * @param interval_ms commit interval
+ * @param budget_bytes appended bytes which trigger commit before the interval
+ * @param _compact_bytes the journal is compacted, when it grows over it; 0 - never
+ * @return true if the journal is open
+ */
+bool journal_t::open(const std::string &_path, unsigned interval_ms, size_t budget_bytes, size_t _compact_bytes)
+{
+    path = _path;
+    interval = std::chrono::milliseconds(interval_ms);
+    budget = budget_bytes;
+    compact_bytes = _compact_bytes;
+
+    std::error_code ec;
+    std::filesystem::remove(path + compact_ext, ec); // an interrupted compaction; the journal is intact
+    if (std::filesystem::exists(path + replay_ext, ec))
+        std::filesystem::remove(path, ec);
+    else if (std::filesystem::exists(path, ec))
+        std::filesystem::rename(path, path + replay_ext, ec);
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return false;
+    committer = std::thread(&journal_t::run, this);
+    return true;
+}
+
+/**
+ * @brief Appends a record to the commit buffer; mtx must be held
+ */
+void journal_t::put(journal_record_t::type_t type, uint64_t id, uint64_t handle, const void *payload, size_t length)
+{
+    journal_record_t record{.length = static_cast<uint32_t>(length),
+                            .type = type,
+                            .id = id,
+                            .handle = handle,
+                            .checksum = checksum(payload, length)};
+    bool was_empty = buf.empty();
+    buf.append(reinterpret_cast<const char *>(&record), sizeof(record));
+    buf.append(static_cast<const char *>(payload), length);
+    appended += sizeof(record) + length;
+    if (was_empty || buf.size() >= budget)
+        cv.notify_one();
+}
+
+/**
+ * @brief Journals a received command; waits only if the committer lags far behind
+ * @param ch connection handle
+ * @param cmd the command
+ * @return LSN of the command
+ */
+uint64_t journal_t::append(connection_handle_t ch, const std::string &cmd)
+{
+    std::unique_lock lock(mtx);
+    committed_cv.wait(lock, [this]()
+                      { return buf.size() < 4 * budget || stopping; });
+    auto lsn = next_lsn++;
+    pending.emplace_back(appended, false);
+    put(journal_record_t::Cmd, lsn, ch, cmd.data(), cmd.size());
+    return lsn;
+}
+
+/**
+ * @brief Journals the commands of a block as done; called when the last sink has written the block
+ * @param seq block sequence number
+ * @param lsns LSNs of the block's commands
+ */
+void journal_t::done(uint64_t seq, const std::vector<uint64_t> &lsns)
+{
+    if (lsns.empty())
+        return;
+    std::lock_guard g(mtx);
+    put(journal_record_t::Done, seq, 0, lsns.data(), lsns.size() * sizeof(uint64_t));
+    resolve(lsns);
+}
+
+/**
+ * @brief Lets the watermark pass commands, which are not to be output: a dropped or an empty block.
+ *        They are not marked done, so they are replayed after a crash, until compaction drops them
+ * @param lsns LSNs of the commands
+ */
+void journal_t::forget(const std::vector<uint64_t> &lsns)
+{
+    if (lsns.empty())
+        return;
+    std::lock_guard g(mtx);
+    resolve(lsns);
+}
+
+/**
+ * @brief Marks commands resolved and advances the watermark over the resolved ones; mtx must be held
+ * @param lsns LSNs of the commands
+ */
+void journal_t::resolve(const std::vector<uint64_t> &lsns)
+{
+    for (auto lsn : lsns)
+        if (lsn >= watermark && lsn - watermark < pending.size())
+            pending[lsn - watermark].second = true;
+    while (!pending.empty() && pending.front().second)
+    {
+        pending.pop_front();
+        ++watermark;
+    }
+}
+
+/**
+ * @brief A sink has written a journaled block; the last one journals it as done
+ * @param block the block
+ */
+void journal_countdown_t::written(const cmd_block_t &block)
+{
+    if (left.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+    if (dropped.load(std::memory_order_acquire))
+        journal.forget(block.lsns);
+    else
+        journal.done(block.seq, block.lsns);
+}
+
+/**
+ * @brief A sink dropped a journaled block by its overflow policy: the block is never done
+ * @param block the block
+ */
+void journal_countdown_t::dropped_by_sink(const cmd_block_t &block)
+{
+    dropped.store(true, std::memory_order_release);
+    written(block);
+}
+
+/**
+ * @brief The committer thread: once there are appended records, waits for the interval
+ *        or the budget, then writes everything appended meanwhile and fsyncs it at once
+ */
+void journal_t::run()
+{
+    std::string batch;
+    std::unique_lock lock(mtx);
+    while (true)
+    {
+        cv.wait(lock, [this]()
+                { return !buf.empty() || stopping; });
+        cv.wait_for(lock, interval, [this]()
+                    { return buf.size() >= budget || urgent || stopping; });
+        if (buf.empty() && stopping)
+            return;
+        urgent = false;
+        batch.swap(buf);
+        auto end = appended;
+        lock.unlock();
+
+        for (size_t written = 0; written < batch.size();)
+        {
+            auto n = ::write(fd, batch.data() + written, batch.size() - written);
+            if (n < 0)
+            {
+                std::cerr << "journal write error" << std::endl;
+                std::quick_exit(2);
+            }
+            written += n;
+        }
+        if (::fdatasync(fd))
+        {
+            std::cerr << "journal sync error" << std::endl;
+            std::quick_exit(2);
+        }
+        batch.clear();
+
+        lock.lock();
+        durable = end;
+        committed_cv.notify_all();
+
+        // The head of the file below the watermark's Cmd record is not needed for replay any more
+        auto cut = std::min(pending.empty() ? appended : pending.front().first, durable);
+        if (compact_bytes && durable - file_base >= compact_bytes && cut - file_base >= (durable - file_base) / 2)
+        {
+            lock.unlock();
+            compact(cut, end);
+            lock.lock();
+            file_base = cut;
+        }
+    }
+}
+
+/**
+ * @brief Copies the journal's bytes [cut, end) into a new file, which replaces the journal atomically;
+ *        called on the committer thread, which is the only writer. A crash leaves either journal intact
+ * @param cut appended bytes before the new head
+ * @param end appended bytes written to the journal
+ */
+void journal_t::compact(uint64_t cut, uint64_t end)
+{
+    auto compact_path = path + compact_ext;
+    int new_fd = ::open(compact_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (new_fd < 0)
+    {
+        std::cerr << "journal compaction open error" << std::endl;
+        std::quick_exit(2);
+    }
+    std::string chunk(256 * 1024, '\0');
+    for (uint64_t pos = cut - file_base, file_end = end - file_base; pos < file_end;)
+    {
+        auto n = ::pread(fd, chunk.data(), std::min<uint64_t>(chunk.size(), file_end - pos), pos);
+        if (n <= 0 || ::write(new_fd, chunk.data(), n) != n)
+        {
+            std::cerr << "journal compaction write error" << std::endl;
+            std::quick_exit(2);
+        }
+        pos += n;
+    }
+    if (::fdatasync(new_fd) || ::rename(compact_path.c_str(), path.c_str()))
+    {
+        std::cerr << "journal compaction sync error" << std::endl;
+        std::quick_exit(2);
+    }
+    auto dir = std::filesystem::path(path).parent_path();
+    int dir_fd = ::open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0)
+    {
+        ::fsync(dir_fd); // the rename is durable
+        ::close(dir_fd);
+    }
+    ::close(fd);
+    fd = new_fd;
+}
+
+/**
+ * @brief Waits until everything appended before the call is written and fsynced
+ */
+void journal_t::sync()
+{
+    std::unique_lock lock(mtx);
+    auto target = appended;
+    urgent = true;
+    cv.notify_one();
+    committed_cv.wait(lock, [this, target]()
+                      { return durable >= target; });
+}
+
+/**
+ * @brief Reads the records of a journal one by one, up to a torn tail or an unknown record
+ * @param file the journal
+ * @param fn called with every record and its payload
+ */
+static void read_records(std::ifstream &file, const std::function<void(const journal_record_t &, const std::string &)> &fn)
+{
+    journal_record_t record;
+    std::string payload;
+    while (file.read(reinterpret_cast<char *>(&record), sizeof(record)))
+    {
+        if (record.type != journal_record_t::Cmd && record.type != journal_record_t::Done)
+            break;
+        payload.resize(record.length);
+        if (!file.read(payload.data(), record.length) || record.checksum != checksum(payload.data(), record.length))
+            break; // torn tail
+        fn(record, payload);
+    }
+}
+
+/**
+ * @brief Replays commands of the previous journal, which are not in done blocks, in their original order.
+ *        The journal is streamed twice: done LSNs are collected first, then the rest of commands is replayed,
+ *        so only the done set is in memory; compaction keeps it small
+ * @param fn replays a command of a connection of the previous run
+ */
+void journal_t::replay(const replay_fn_t &fn)
+{
+    std::ifstream file(path + replay_ext, std::ios::binary);
+    if (!file.is_open())
+        return;
+
+    std::unordered_set<uint64_t> done;
+    read_records(file, [&done](const journal_record_t &record, const std::string &payload)
+                 {
+                     if (record.type == journal_record_t::Done)
+                         for (size_t i = 0; i + sizeof(uint64_t) <= payload.size(); i += sizeof(uint64_t))
+                         {
+                             uint64_t lsn;
+                             std::memcpy(&lsn, payload.data() + i, sizeof(lsn));
+                             done.insert(lsn);
+                         } });
+
+    size_t n_replayed = 0;
+    file.clear();
+    file.seekg(0);
+    read_records(file, [&](const journal_record_t &record, const std::string &payload)
+                 {
+                     if (record.type == journal_record_t::Cmd && !done.contains(record.id))
+                     {
+                         fn(record.handle, payload);
+                         ++n_replayed;
+                     } });
+    if (n_replayed)
+        std::cerr << "journal: " << n_replayed << " commands replayed" << std::endl;
+}
+
+/**
+ * @brief Makes replayed commands durable in the new journal and removes the previous one
+ */
+void journal_t::replayed()
+{
+    sync();
+    std::error_code ec;
+    std::filesystem::remove(path + replay_ext, ec);
+}
+
+/**
+ * @brief Commits the rest of records and stops the committer
+ * @param remove removes the journal: everything is output, nothing is to replay
+ */
+void journal_t::close(bool remove)
+{
+    {
+        std::lock_guard g(mtx);
+        if (fd < 0)
+            return;
+        stopping = true;
+    }
+    cv.notify_one();
+    committed_cv.notify_all();
+    if (committer.joinable())
+        committer.join();
+    ::close(fd);
+    fd = -1;
+    if (remove)
+        ::unlink(path.c_str());
+}
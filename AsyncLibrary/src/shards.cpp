@@ -0,0 +1,183 @@
+/**
+ * @brief shards.cpp - realizes shared-nothing sharded execution mode for 'async' library
+ */
+#include "shards.h"
+#include "instance.h"
+#include "spin_wait.h"
+#include <utility>
+
+/**
+ * @brief Creates a shard, whose ingress thread applies operations to shard-owned contexts
+ */
+shard_t::shard_t(library_t &_lib) : lib(_lib), ingress([this](ingress_op_t &op)
+                                                      { apply(op); },
+                                                      std::chrono::microseconds(lib.options.spin_us),
+                                                      [this]()
+                                                      { lib.output.blocks_q.flush_inline(); })
+{
+}
+
+/**
+ * @brief Applies an operation on the shard thread; input contexts are not locked,
+ *        since no other thread touches them
+ * @param op operation to apply
+ */
+void shard_t::apply(ingress_op_t &op)
+{
+    switch (op.kind)
+    {
+    case ingress_op_t::Connect:
+        ctxs.emplace(op.handle, nullptr);
+        lib.n_connections.fetch_add(1, std::memory_order_relaxed);
+        lib.output.try_to_launch();
+        break;
+    case ingress_op_t::Receive:
+    {
+        auto p = ctxs.find(op.handle);
+        if (p == ctxs.end())
+            break; // an unknown or disconnected handle is ignored, as in unsharded mode
+        auto &ctx = p->second;
+        for (auto &cmd : op.cmds)
+            if (cmd.size() && lib.process_cmd(ctx, cmd, lib.journal_cmd(op.handle, cmd)))
+            {
+                publish(op.handle, *ctx);
+                lib.release_context(ctx);
+            }
+        break;
+    }
+    case ingress_op_t::Disconnect:
+    {
+        auto p = ctxs.find(op.handle);
+        if (p != ctxs.end())
+        {
+            if (p->second)
+                publish(op.handle, *p->second);
+            lib.release_context(p->second);
+            ctxs.erase(p);
+            lib.n_connections.fetch_sub(1, std::memory_order_relaxed);
+        }
+        break;
+    }
+    }
+}
+
+/**
+ * @brief Pushes a finished block into the shard's ring and rings collector's doorbell;
+ *        if the ring is full, waits for collector (backpressure to the ingress queue)
+ * @param ch connection handle
+ * @param ctx input context, whose dynamic commands are cleared
+ */
+void shard_t::publish(connection_handle_t ch, input_context_t &ctx)
+{
+    if (ctx.dyna_cmds.empty() && !ctx.dyna_spill)
+        return;
+    published_block_t block{ch, std::move(ctx.dyna_cmds), std::move(ctx.dyna_lsns), std::move(ctx.dyna_spill)};
+    ctx.dyna_cmds.clear();
+    ctx.dyna_lsns.clear();
+    ctx.dyna_bytes = 0;
+
+    lib.shards.in_flight.fetch_add(1);
+    while (!published.try_push(block))
+        std::this_thread::yield();
+    lib.shards.doorbell.fetch_add(1, std::memory_order_release);
+    lib.shards.doorbell.notify_one();
+}
+
+/**
+ * @brief The shard owning a connection; creates shards and collector on first use
+ * @param ch connection handle
+ */
+shard_t &shards_t::of(connection_handle_t ch)
+{
+    std::call_once(launched, [this]()
+                   {
+                       for (size_t i = 0; i < n_shards; ++i)
+                           pool.emplace_back(std::make_unique<shard_t>(lib));
+                       collector = std::thread(&shards_t::collect, this); });
+    return *pool[ch % n_shards];
+}
+
+/**
+ * @brief The collector thread: moves published blocks from all the shards' rings
+ *        into the output queue; sleeps on the doorbell when all the rings are empty,
+ *        exits when stopped and the rings are empty. In inline output mode, it writes
+ *        the partial batches, when the rings run empty
+ */
+void shards_t::collect()
+{
+    published_block_t block;
+    bool flushed = true;
+    while (true)
+    {
+        auto seen = doorbell.load(std::memory_order_acquire);
+        bool collected = false;
+        for (auto &shard : pool)
+            while (shard->published.try_pop(block))
+            {
+                collected = true;
+                lib.output.blocks_q.push(block.cmds, block.lsns, block.handle, std::move(block.spill));
+                in_flight.fetch_sub(1);
+                in_flight.notify_all();
+            }
+        if (collected)
+            flushed = false;
+        else if (!flushed)
+        {
+            lib.output.blocks_q.flush_inline();
+            flushed = true;
+            continue; // the flush took time, the rings are checked again
+        }
+        if (!collected && stopping.load())
+            return;
+        if (!collected)
+            spin_wait(doorbell, seen, std::chrono::microseconds(lib.options.spin_us));
+    }
+}
+
+/**
+ * @brief Waits until the operations posted to shards are applied
+ *        and the published blocks are moved into the output queue
+ */
+void shards_t::flush()
+{
+    for (auto &shard : pool)
+        shard->ingress.flush();
+    for (auto n = in_flight.load(); n; n = in_flight.load())
+        in_flight.wait(n);
+}
+
+/**
+ * @brief Pushes the rest of dynamic commands of every connection into output queue
+ *        and stops the shards; shard threads are idle after 'flush', so their contexts are taken over
+ */
+void shards_t::terminate()
+{
+    flush();
+    for (auto &shard : pool)
+    {
+        for (auto &[ch, ctx] : shard->ctxs)
+            if (ctx)
+            {
+                lib.output.blocks_q.push(*ctx, ch);
+                lib.release_context(ctx);
+            }
+        lib.n_connections.fetch_sub(shard->ctxs.size(), std::memory_order_relaxed);
+        shard->ctxs.clear();
+    }
+    stop();
+}
+
+/**
+ * @brief Joins shard threads and the collector
+ */
+void shards_t::stop()
+{
+    for (auto &shard : pool)
+        shard->ingress.stop(); // nothing is published after that
+    stopping.store(true);
+    doorbell.fetch_add(1, std::memory_order_release);
+    doorbell.notify_one();
+    if (collector.joinable())
+        collector.join();
+    pool.clear();
+}
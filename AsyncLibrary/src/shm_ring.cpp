@@ -0,0 +1,293 @@
+/**
+ * @brief shm_ring.cpp - realizes shared-memory ingestion ring of 'async' library
+ */
+#include "shm_ring.h"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <new>
+#include <thread>
+#include <fcntl.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+/**
+ * @brief Writes bytes into data area, wrapping around its end
+ * @param pos stream position, not reduced modulo capacity
+ */
+void shm_ring_t::copy_in(uint64_t pos, const void *src, size_t n)
+{
+    auto offset = pos & (capacity - 1);
+    auto first = std::min<size_t>(n, capacity - offset);
+    std::memcpy(data() + offset, src, first);
+    std::memcpy(data(), static_cast<const char *>(src) + first, n - first);
+}
+
+/**
+ * @brief Reads bytes from data area, wrapping around its end
+ * @param pos stream position, not reduced modulo capacity
+ */
+void shm_ring_t::copy_out(uint64_t pos, void *dst, size_t n) const
+{
+    auto offset = pos & (capacity - 1);
+    auto first = std::min<size_t>(n, capacity - offset);
+    std::memcpy(dst, data() + offset, first);
+    std::memcpy(static_cast<char *>(dst) + first, data(), n - first);
+}
+
+/**
+ * @brief Unmaps the ring and closes its descriptors
+ */
+void shm_ring_t::unmap()
+{
+    if (hdr)
+        munmap(hdr, map_size);
+    hdr = nullptr;
+    for (auto fd : {mem_fd, bell_fd})
+        if (fd >= 0)
+            ::close(fd);
+    mem_fd = bell_fd = -1;
+}
+
+/**
+ * @brief Creates the ring and the doorbell and passes them to the server
+ * @param socket_path AF_UNIX socket path of server's shared-memory listener
+ * @param capacity size of data area, rounded up to a power of 2
+ * @return true if the server has got the ring
+ */
+bool shm_producer_t::open(const char *socket_path, size_t _capacity)
+{
+    capacity = std::bit_ceil(std::max<size_t>(_capacity, 64));
+    map_size = sizeof(shm_ring_header_t) + capacity;
+    mem_fd = memfd_create("bulk_ring", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    bell_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    // The server maps the ring: its size is sealed, so that it never gets SIGBUS
+    if (mem_fd < 0 || bell_fd < 0 || ftruncate(mem_fd, map_size) ||
+        fcntl(mem_fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL))
+    {
+        unmap();
+        return false;
+    }
+    auto p = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+    if (p == MAP_FAILED)
+    {
+        unmap();
+        return false;
+    }
+    hdr = new (p) shm_ring_header_t;
+    std::memcpy(hdr->magic, shm_ring_magic, sizeof(hdr->magic));
+    hdr->capacity = capacity;
+
+    // Pass both descriptors with one byte of payload
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    std::strncpy(addr.sun_path, socket_path, sizeof(addr.sun_path) - 1);
+    char byte = 0;
+    iovec iov{.iov_base = &byte, .iov_len = 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    int fds[2] = {mem_fd, bell_fd};
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    bool res = sock >= 0 &&
+               !connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) &&
+               sendmsg(sock, &msg, MSG_NOSIGNAL) == 1;
+    if (sock >= 0)
+        ::close(sock);
+    if (!res)
+        unmap();
+    return res;
+}
+
+/**
+ * @brief Writes a command into the ring; waits while the ring is full (backpressure);
+ *        rings the doorbell only if the consumer sleeps
+ * @param cmd command; truncated to the ring capacity
+ */
+void shm_producer_t::send(std::string_view cmd)
+{
+    if (!hdr)
+        return;
+    uint32_t len = std::min<size_t>(cmd.size(), capacity - sizeof(uint32_t));
+    auto tail = hdr->tail.load(std::memory_order_relaxed);
+    while (capacity - (tail - hdr->head.load(std::memory_order_acquire)) < sizeof(len) + len)
+        std::this_thread::yield();
+    copy_in(tail, &len, sizeof(len));
+    copy_in(tail + sizeof(len), cmd.data(), len);
+    hdr->tail.store(tail + sizeof(len) + len, std::memory_order_release);
+
+    // Pairs with the fence in 'shm_consumer_t::sleep': either the consumer sees the new tail,
+    // or the producer sees it sleeping
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (hdr->sleeping.load(std::memory_order_relaxed) && hdr->sleeping.exchange(0))
+    {
+        uint64_t one = 1;
+        [[maybe_unused]] auto n = write(bell_fd, &one, sizeof(one));
+    }
+}
+
+/**
+ * @brief Marks the ring closed and wakes the consumer up; the server disconnects
+ *        once it has taken the rest of commands
+ */
+void shm_producer_t::close()
+{
+    if (!hdr)
+        return;
+    hdr->closed.store(1, std::memory_order_release);
+    uint64_t one = 1;
+    [[maybe_unused]] auto n = write(bell_fd, &one, sizeof(one));
+    unmap();
+}
+
+/**
+ * @brief Maps the ring received from a producer; the descriptors are owned afterwards.
+ *        The memfd must be sealed against shrinking: otherwise the producer could truncate it
+ *        under the mapping, and the server would get SIGBUS
+ * @param _mem_fd ring memfd
+ * @param _bell_fd doorbell eventfd
+ * @return false if the memory is not a valid ring
+ */
+bool shm_consumer_t::attach(int _mem_fd, int _bell_fd)
+{
+    mem_fd = _mem_fd;
+    bell_fd = _bell_fd;
+    auto seals = fcntl(mem_fd, F_GET_SEALS);
+    struct stat st;
+    if (seals < 0 || !(seals & F_SEAL_SHRINK) ||
+        fstat(mem_fd, &st) || st.st_size <= static_cast<off_t>(sizeof(shm_ring_header_t)))
+    {
+        unmap();
+        return false;
+    }
+    map_size = st.st_size;
+    auto p = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, mem_fd, 0);
+    if (p == MAP_FAILED)
+    {
+        unmap();
+        return false;
+    }
+    hdr = static_cast<shm_ring_header_t *>(p);
+    capacity = hdr->capacity;
+    if (std::memcmp(hdr->magic, shm_ring_magic, sizeof(hdr->magic)) ||
+        !std::has_single_bit(capacity) || sizeof(shm_ring_header_t) + capacity != map_size)
+    {
+        unmap();
+        return false;
+    }
+    head = hdr->head.load(std::memory_order_relaxed);
+    return true;
+}
+
+/**
+ * @brief Takes commands out of the ring. The producer is not trusted: a tail more than capacity
+ *        ahead of head, or a frame longer than the ring or than the bytes produced, breaks the ring,
+ *        and nothing is read out of it any more
+ * @param cmds commands are appended to
+ * @param max_cmds max nof commands to take
+ * @return nof commands taken
+ */
+size_t shm_consumer_t::fetch(std::vector<std::string> &cmds, size_t max_cmds)
+{
+    if (broken)
+        return 0;
+    auto tail = hdr->tail.load(std::memory_order_acquire);
+    if (tail - head > capacity)
+    {
+        broken = true;
+        return 0;
+    }
+    size_t n = 0;
+    for (uint32_t len; n < max_cmds && tail - head >= sizeof(len); ++n)
+    {
+        copy_out(head, &len, sizeof(len));
+        if (len > capacity - sizeof(len) || len > tail - head - sizeof(len))
+        {
+            broken = true;
+            break;
+        }
+        auto &cmd = cmds.emplace_back(len, '\0');
+        copy_out(head + sizeof(len), cmd.data(), len);
+        head += sizeof(len) + len;
+    }
+    hdr->head.store(head, std::memory_order_release);
+    return n;
+}
+
+/**
+ * @brief Announces that the consumer waits for the doorbell
+ * @return false if there is something to take or the ring is closed, so there is no need to wait
+ */
+bool shm_consumer_t::sleep()
+{
+    hdr->sleeping.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (broken || hdr->tail.load(std::memory_order_acquire) != head || hdr->closed.load(std::memory_order_acquire))
+    {
+        hdr->sleeping.store(0, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Consumes doorbell events after wake up
+ */
+void shm_consumer_t::wake()
+{
+    uint64_t events;
+    [[maybe_unused]] auto n = read(bell_fd, &events, sizeof(events));
+    hdr->sleeping.store(0, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Producer has disconnected and all the commands are taken, or the ring is broken
+ */
+bool shm_consumer_t::closed() const
+{
+    return broken ||
+           (hdr->closed.load(std::memory_order_acquire) && hdr->tail.load(std::memory_order_acquire) == head);
+}
+
+/**
+ * @brief Receives ring descriptors, passed by 'shm_producer_t::open' over an AF_UNIX socket
+ * @param socket_fd the accepted socket
+ * @param mem_fd ring memfd
+ * @param bell_fd doorbell eventfd
+ * @return false if no descriptors are received
+ */
+bool shm_receive_fds(int socket_fd, int &mem_fd, int &bell_fd)
+{
+    char byte;
+    iovec iov{.iov_base = &byte, .iov_len = 1};
+    alignas(cmsghdr) char control[CMSG_SPACE(2 * sizeof(int))] = {};
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(socket_fd, &msg, MSG_CMSG_CLOEXEC) != 1)
+        return false;
+    auto cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+        return false;
+    int fds[2];
+    std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    mem_fd = fds[0];
+    bell_fd = fds[1];
+    return true;
+}
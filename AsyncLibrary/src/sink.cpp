@@ -0,0 +1,493 @@
+/**
+ * @brief sink.cpp - realizes output sinks of 'async' library
+ */
+#include "sink.h"
+#include "cmd_output.h"
+#include "common.h"
+#include "spin_wait.h"
+#include <cassert>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/**
+ * @brief Writes a block line to console
+ */
+void console_sink_t::write(const cmd_block_t &block)
+{
+    write_block_to_stream(block, std::cout);
+}
+
+/**
+ * @brief Opens the block store, if it is the file format
+ */
+bool file_sink_t::open()
+{
+    return file_format != file_format_t::block_store || store.open(log_dir);
+}
+
+/**
+ * @brief Writes a block into the block store or into its own text file
+ */
+void file_sink_t::write(const cmd_block_t &block)
+{
+    if (file_format == file_format_t::block_store)
+    {
+        store.append(block);
+        return;
+    }
+    std::string path = log_dir                            //
+                       + std::string("/bulk")             //
+                       + std::to_string(block.timestamp)  //
+                       + std::string("_")                 //
+                       + this_pid_to_string()             //
+                       + std::string(".log");
+    try
+    {
+        std::ofstream _file(path);
+        assert(_file.is_open());
+
+        write_block_to_stream(block, _file);
+    }
+    catch (const std::exception &e)
+    {
+        std::cerr << "file write error" << std::endl;
+        std::quick_exit(2);
+    }
+}
+
+/**
+ * @brief Closes the block store
+ */
+void file_sink_t::close()
+{
+    store.close();
+}
+
+/**
+ * @brief Connects to the aggregator; sends time out, so that a stuck aggregator
+ *        does not hold the sink's thread forever. mtx must be held
+ * @return true if connected
+ */
+bool tcp_sink_t::reconnect()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    timeval timeout{.tv_sec = 1, .tv_usec = 0};
+    if (fd < 0 || inet_pton(AF_INET, ip_addr.c_str(), &addr.sin_addr) != 1 ||
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) ||
+        connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)))
+    {
+        if (fd >= 0)
+            ::close(fd);
+        fd = -1;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Sends a block line to the aggregator; retries until it is sent,
+ *        or the instance stops while the aggregator is unreachable
+ */
+void tcp_sink_t::write(const cmd_block_t &block)
+{
+    if (block.spill)
+    {
+        write_spilled(block);
+        return;
+    }
+    std::ostringstream ss;
+    write_block_to_stream(block, ss);
+    auto line = ss.str();
+
+    std::lock_guard g(mtx);
+    for (size_t sent = 0; sent < line.size();)
+    {
+        if (fd < 0 && !reconnect())
+        {
+            if (stopping.load())
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        auto n = send(fd, line.data() + sent, line.size() - sent, MSG_NOSIGNAL);
+        if (n > 0)
+            sent += n;
+        else if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+        {
+            if (stopping.load())
+                return;
+        }
+        else
+        {
+            ::close(fd); // the line is sent again by a new connection
+            fd = -1;
+            sent = 0;
+        }
+    }
+}
+
+/**
+ * @brief Sends a spilled block line by pieces, as it is read back from the spill file;
+ *        a broken connection is re-established, and the line is sent again from its start
+ */
+void tcp_sink_t::write_spilled(const cmd_block_t &block)
+{
+    std::lock_guard g(mtx);
+    while (true)
+    {
+        if (fd < 0 && !reconnect())
+        {
+            if (stopping.load())
+                return;
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+        bool sent = format_spilled_block(block, [this](std::string_view piece)
+                                         {
+                                             while (!piece.empty())
+                                             {
+                                                 auto n = send(fd, piece.data(), piece.size(), MSG_NOSIGNAL);
+                                                 if (n > 0)
+                                                     piece.remove_prefix(n);
+                                                 else if ((errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) || stopping.load())
+                                                     return false;
+                                             }
+                                             return true; });
+        if (sent || stopping.load())
+            return;
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+/**
+ * @brief Closes the connection
+ */
+void tcp_sink_t::close()
+{
+    std::lock_guard g(mtx);
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+/**
+ * @brief Creates a sink runner; the spill file is created on first overflow
+ * @param _sink the sink
+ * @param _options workers, buffer limit, overflow policy
+ * @param spill_dir directory for spill file
+ * @param _spin the threads spin so long before sleeping
+ * @param _inline_batch inline output: blocks are written on the pushing thread by so many; 0 - the sink's own threads
+ */
+sink_runner_t::sink_runner_t(std::unique_ptr<sink_t> _sink, const sink_options_t &_options, const std::string &spill_dir,
+                             std::chrono::microseconds _spin, size_t _inline_batch)
+    : sink(std::move(_sink)), options(_options), spin(_spin),
+      spill_path(spill_dir + "/spill_" + sink->name() + "_" + std::to_string(getpid()) + ".tmp"),
+      inline_batch(_inline_batch)
+{
+    if (!options.limit)
+        options.limit = 1;
+}
+
+/**
+ * @brief Buffers a block for the sink; when the buffer is full, applies the overflow policy.
+ *        In inline output mode, a full batch is written at once on the calling thread
+ * @param block the block
+ */
+void sink_runner_t::push(const sp_block_t &block)
+{
+    std::unique_lock lock(mtx);
+    if (inline_batch)
+    {
+        q.push_back(block);
+        if (q.size() >= inline_batch)
+            write_inline();
+        return;
+    }
+    switch (options.overflow)
+    {
+    case overflow_t::block: // the producer waits for room in wait_room, out of the output queue's lock
+        q.push_back(block);
+        break;
+    case overflow_t::drop_oldest:
+        if (q.size() >= options.limit)
+        {
+            if (q.front()->countdown)
+                q.front()->countdown->dropped_by_sink(*q.front());
+            q.pop_front(); // released here, if the other sinks are done with it
+            ++n_dropped;
+        }
+        q.push_back(block);
+        break;
+    case overflow_t::spill:
+        if (spilled || q.size() >= options.limit) // once spilling, keep the order: newer blocks follow spilled ones
+        {
+            spill_block(block);
+            ++n_spilled;
+        }
+        else
+            q.push_back(block);
+        break;
+    }
+    lock.unlock();
+    ready_cv.notify_one();
+}
+
+/**
+ * @brief With overflow_t::block, waits until the sink's buffer is within its limit again.
+ *        Called after the block is queued for all the sinks, so a slow sink holds its producer back,
+ *        but not the other sinks
+ */
+void sink_runner_t::wait_room()
+{
+    if (options.overflow != overflow_t::block || inline_batch)
+        return;
+    std::unique_lock lock(mtx);
+    room_cv.wait(lock, [this]()
+                 { return q.size() <= options.limit || stopping; });
+}
+
+/**
+ * @brief Fair scheduling: waits until the sink's threads have taken all but credit blocks,
+ *        so the next blocks are chosen by the fair queue when the sink can output them.
+ *        Only a sink, which holds its producers back (overflow_t::block), paces the dispatch:
+ *        'drop' and 'spill' sinks absorb their overflow by their policies and hold no one back
+ * @param credit max nof blocks, buffered or spilled, left to the sink
+ */
+void sink_runner_t::wait_credit(size_t credit)
+{
+    if (options.overflow != overflow_t::block || inline_batch)
+        return;
+    std::unique_lock lock(mtx);
+    room_cv.wait(lock, [this, credit]()
+                 { return q.size() + spilled < credit || !pacing || stopping; });
+}
+
+/**
+ * @brief Stops pacing by wait_credit: at stop, the rest of the fair queue goes to the sinks at once
+ */
+void sink_runner_t::end_pacing()
+{
+    {
+        std::lock_guard g(mtx);
+        pacing = false;
+    }
+    room_cv.notify_all();
+}
+
+/**
+ * @brief Appends a block to spill file; mtx must be held.
+ *        A block with its own spill file is kept by reference, its record only marks its place
+ */
+void sink_runner_t::spill_block(const sp_block_t &shared)
+{
+    auto &block = *shared;
+    if (!spill.is_open())
+    {
+        spill.open(spill_path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!spill.is_open())
+        {
+            std::cerr << "spill file open error" << std::endl;
+            std::quick_exit(2);
+        }
+    }
+    auto put = [this](const auto &value)
+    { spill.write(reinterpret_cast<const char *>(&value), sizeof(value)); };
+
+    spill.seekp(0, std::ios::end);
+    put(block.timestamp);
+    put(block.handle);
+    put(block.seq);
+    put(block.mono_ns);
+    if (block.spill)
+    {
+        put(spilled_ref);
+        spilled_refs.push_back(shared);
+        ++spilled;
+        return;
+    }
+    put(static_cast<uint32_t>(block.cmds.size()));
+    for (auto &cmd : block.cmds)
+    {
+        auto text = cmd.view();
+        put(static_cast<uint32_t>(text.size()));
+        spill.write(text.data(), text.size());
+    }
+    put(static_cast<uint32_t>(block.lsns.size()));
+    spill.write(reinterpret_cast<const char *>(block.lsns.data()), block.lsns.size() * sizeof(uint64_t));
+    spilled_countdowns.push_back(block.countdown); // the block is not written yet
+    ++spilled;
+}
+
+/**
+ * @brief Reads the oldest spilled block; truncates spill file, once it is read out. mtx must be held
+ */
+sp_block_t sink_runner_t::unspill_block()
+{
+    auto block = std::make_shared<cmd_block_t>();
+    auto get = [this](auto &value)
+    { spill.read(reinterpret_cast<char *>(&value), sizeof(value)); };
+
+    spill.seekg(spill_read);
+    get(block->timestamp);
+    get(block->handle);
+    get(block->seq);
+    get(block->mono_ns);
+    uint32_t n;
+    get(n);
+    sp_block_t result = block;
+    if (n == spilled_ref) // the block is kept by reference
+    {
+        result = std::move(spilled_refs.front());
+        spilled_refs.pop_front();
+    }
+    else
+    {
+        block->cmds.reserve(n);
+        std::string text;
+        for (uint32_t i = n; i--;)
+        {
+            get(n);
+            text.resize(n);
+            spill.read(text.data(), n);
+            block->cmds.emplace_back(text); // spilled blocks come back with own texts, not interned
+        }
+        get(n);
+        block->lsns.resize(n);
+        spill.read(reinterpret_cast<char *>(block->lsns.data()), n * sizeof(uint64_t));
+        block->countdown = std::move(spilled_countdowns.front());
+        spilled_countdowns.pop_front();
+    }
+    if (!spill)
+    {
+        std::cerr << "spill file read error" << std::endl;
+        std::quick_exit(2);
+    }
+    spill_read = spill.tellg();
+
+    if (!--spilled)
+    {
+        spill.close();
+        spill.open(spill_path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        spill_read = 0;
+    }
+    return result;
+}
+
+/**
+ * @brief The sink's thread: outputs buffered blocks, then spilled ones;
+ *        exits when stopped and nothing is left
+ */
+void sink_runner_t::run()
+{
+    std::unique_lock lock(mtx);
+    while (true)
+    {
+        spin_wait(lock, ready_cv, spin, [this]()
+                  { return !q.empty() || spilled || stopping; });
+        sp_block_t block;
+        if (!q.empty())
+        {
+            block = std::move(q.front());
+            q.pop_front();
+        }
+        else if (spilled)
+            block = unspill_block();
+        else
+            return; // stopping, nothing is left
+        room_cv.notify_all(); // a blocked producer and the fair queue's dispatcher
+
+        lock.unlock();
+        sink->write(*block);
+        if (block->countdown)
+            block->countdown->written(*block);
+        block.reset(); // released, if the other sinks are done with it
+        lock.lock();
+    }
+}
+
+/**
+ * @brief Inline output mode: writes the batch in q on the calling thread; mtx must be held.
+ *        Pushers are serialized by the output queue, so the sink gets blocks in their order, one at a time
+ */
+void sink_runner_t::write_inline()
+{
+    while (!q.empty())
+    {
+        sink->write(*q.front());
+        if (q.front()->countdown)
+            q.front()->countdown->written(*q.front());
+        q.pop_front(); // released, if the other sinks are done with it
+    }
+}
+
+/**
+ * @brief Inline output mode: writes a partial batch, when its producer goes idle;
+ *        the caller keeps the order of blocks, as 'push' does
+ */
+void sink_runner_t::flush_inline()
+{
+    if (!inline_batch)
+        return;
+    std::lock_guard g(mtx);
+    write_inline();
+}
+
+/**
+ * @brief Opens the sink and launches its threads; in inline output mode, there are none
+ */
+void sink_runner_t::launch()
+{
+    if (!sink->open())
+    {
+        std::cerr << sink->name() << " sink open error" << std::endl;
+        std::quick_exit(2);
+    }
+    if (inline_batch)
+        return;
+    for (size_t i = 0; i < options.workers; ++i)
+        workers.emplace_back(&sink_runner_t::run, this);
+}
+
+/**
+ * @brief Outputs the rest of blocks, joins the threads and closes the sink
+ */
+void sink_runner_t::stop()
+{
+    {
+        std::lock_guard g(mtx);
+        stopping = true;
+    }
+    ready_cv.notify_all();
+    room_cv.notify_all();
+    sink->stop();
+    if (inline_batch)
+    {
+        std::lock_guard g(mtx);
+        write_inline(); // the rest of the batch
+    }
+    for (auto &th : workers)
+        if (th.joinable())
+            th.join();
+    sink->close();
+    if (spill.is_open())
+    {
+        spill.close();
+        std::remove(spill_path.c_str());
+    }
+    if (n_dropped || n_spilled)
+        std::cerr << sink->name() << " sink: " << n_dropped << " blocks dropped, " << n_spilled << " spilled" << std::endl;
+}
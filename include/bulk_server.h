@@ -5,12 +5,19 @@
 #pragma once
 #include "common.h"
 #include "bulk_server.h"
+#include "capture.h"
 #include "cmd_output.h"
+#include "diag_log.h"
+#include "log_rotation.h"
+#include "session_pool.h"
 #include <boost/asio/awaitable.hpp>
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/ip/address_v4.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
 #include <boost/asio/detached.hpp>
+#include <algorithm>
 #include <iostream>
 #include <tuple>
 #include <string>
@@ -18,16 +25,59 @@
 #include <unordered_map>
 #include <memory>
 #include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+#include <limits>
 
 namespace asio = boost::asio;
 
 using tcp_t = asio::ip::tcp;
+using udp_t = asio::ip::udp;
+using unix_t = asio::local::stream_protocol;
 using port_t = asio::ip::port_type;
 
 constexpr auto default_ip = "127.0.0.1";
 constexpr port_t default_port = 4507;
 constexpr size_t default_cmd_blk_size = 5;
-constexpr char msg_end = '\n';
+constexpr size_t udp_batch_size = 64;      // max nof datagrams taken by one recvmmsg
+constexpr size_t udp_datagram_size = 2048; // datagram buffer size; longer datagrams are dropped
+
+/**
+ * @brief A listening endpoint with its own library instance
+ */
+struct listener_t
+{
+    enum kind_t
+    {
+        Tcp,  // a connection per client
+        Unix, // AF_UNIX stream socket, a connection per client
+        Udp,  // datagrams of \n - delimited commands, one connection for all the producers
+        Shm   // AF_UNIX socket, passing shared-memory rings; a connection per ring
+    };
+    std::string ip_addr; // AF_UNIX socket path for Unix and Shm listeners
+    port_t port;
+    size_t block_size;
+    kind_t kind = Tcp;
+    std::string log_dir{};                        // the instance's output directory
+    std::string journal{};                        // the instance's journal path, if any
+    std::unique_ptr<capture_writer_t> capture{};  // the listener's traffic capture, if any
+    std::unique_ptr<edit::instance_t> instance{}; // isolated pipeline: queue, static buffer, output threads
+    std::string name() const                      // the listener's name, used for its output directory
+    {
+        switch (kind)
+        {
+        case Unix:
+            return "unix_" + std::filesystem::path(ip_addr).filename().string();
+        case Udp:
+            return "udp_" + std::to_string(port);
+        case Shm:
+            return "shm_" + std::filesystem::path(ip_addr).filename().string();
+        default:
+            return std::to_string(port);
+        }
+    }
+};
 
 /**
  * @brief A type storing server params, given in the command string
@@ -37,6 +87,32 @@ struct server_t
     std::string ip_addr;
     port_t port;
     size_t block_size;
+    std::vector<listener_t> listeners; // '--listen*=': extra endpoints; the positional one is added first
+    bool block_store = false;                                     // '--store': write blocks into binary block store instead of per-block files
+    retention_t retention;                                        // '--keep-runs=', '--keep-bytes=': retention of previous runs' log directories
+    size_t shards = 0;                                            // '--shards=': nof shard threads forming dynamic blocks; 0 - no sharding
+    std::string journal;                                          // '--journal=': write-ahead journal path; empty - no journal
+    unsigned journal_interval_ms = 2;                             // '--journal-interval=': journal commit interval, ms
+    size_t journal_bytes = 256 * 1024;                            // '--journal-bytes=': bytes which trigger journal commit before the interval
+    size_t journal_compact = edit::options_t{}.journal_compact;   // '--journal-compact=': journal size, over which it is compacted; 0 - never
+    std::string capture;                                          // '--capture=': traffic capture path for bulk_replay; empty - no capture
+    std::string forward;                                          // '--forward=': address of a downstream aggregator; empty - no forwarding
+    edit::sink_options_t console = edit::options_t{}.console;     // '--sink=console:...'
+    edit::sink_options_t file = edit::options_t{}.file;           // '--sink=file:...'
+    edit::sink_options_t forwarder = edit::options_t{}.forwarder; // '--sink=forward:...'
+    bool low_latency = false;                                     // '--low-latency': socket tuning, spinning io and library threads
+    unsigned spin_us = 50;                                        // '--low-latency=': spinning time before sleeping, us
+    int sock_buf = 1024 * 1024;                                   // '--sock-buf=': SO_RCVBUF/SO_SNDBUF in low-latency mode; 0 - system default
+    bool scale = false;                                           // '--scale': small pooled sessions for large counts of idle connections
+    unsigned mem_stats_s = 0;                                     // '--mem-stats=': memory report interval, s; 0 - no reports
+    std::string log_path;                                         // '--log=': diagnostics destination; empty - stderr
+    diag_level_t log_level = diag_level_t::info;                  // '--log-level=': diagnostics below it are skipped
+    unsigned log_rate = 1000;                                     // '--log-rate=': max diagnostics per second per thread; 0 - unlimited
+    edit::fair_options_t fair;                                    // '--fair[=]': fair scheduling of blocks before the sinks
+    unsigned fair_stats_s = 0;                                    // '--fair-stats=': fairness report interval, s; 0 - no reports
+    size_t intern = 0;                                            // '--intern[=]': max entries of the command intern table; 0 - no interning
+    size_t dynamic_cap = 0;                                       // '--dynamic-cap=': max bytes of a dynamic block in memory; 0 - unlimited
+    size_t inline_output = 0;                                     // '--inline[=]': blocks per batch, written to the sinks inline; 0 - output threads
 };
 
 /**
@@ -50,7 +126,290 @@ inline server_t server;
 inline asio::io_context context;
 
 /**
- * @brief Extracts port, block_size, ip_addr from command line
+ * @brief Matches a '--name=value' option
+ * @param arg command line argument
+ * @param name option name including '=', e.g. "--keep-runs="
+ * @return pointer to the value, or nullptr if the argument is not the option
+ */
+inline const char *option_value(const char *arg, const char *name)
+{
+    return strncmp(arg, name, strlen(name)) ? nullptr : arg + strlen(name);
+}
+
+/**
+ * @brief Parses a decimal option value; an empty value, a sign, trailing chars or overflow are wrong,
+ *        so a mistyped option is rejected instead of becoming 0
+ * @param v option value
+ * @param value set on success
+ * @return false on wrong value
+ */
+template <typename T>
+inline bool parse_number(const char *v, T &value)
+{
+    if (*v < '0' || *v > '9')
+        return false;
+    char *end;
+    errno = 0;
+    auto n = std::strtoull(v, &end, 10);
+    if (*end || errno == ERANGE || n > static_cast<unsigned long long>(std::numeric_limits<T>::max()))
+        return false;
+    value = static_cast<T>(n);
+    return true;
+}
+
+/**
+ * @brief Parses a listener option value: <ip address>:<port number>[:<cmd block size>],
+ *        or <path>[:<cmd block size>] for Unix and Shm listeners; port and block size are parsed
+ *        with parse_number, and neither may be 0
+ * @param v option value
+ * @param listener listener, whose kind is set
+ * @return false on wrong value
+ */
+inline bool parse_listener(const char *v, listener_t &listener)
+{
+    listener.ip_addr = v;
+    listener.port = default_port;
+    listener.block_size = default_cmd_blk_size;
+    if (listener.kind == listener_t::Unix || listener.kind == listener_t::Shm)
+    {
+        auto colon = listener.ip_addr.rfind(':');
+        if (colon != std::string::npos && colon + 1 < listener.ip_addr.size() &&
+            listener.ip_addr.find_first_not_of("0123456789", colon + 1) == std::string::npos)
+        {
+            if (!parse_number(v + colon + 1, listener.block_size))
+                return false;
+            listener.ip_addr.resize(colon);
+        }
+        return !listener.ip_addr.empty() && listener.block_size;
+    }
+    auto colon = listener.ip_addr.find(':');
+    if (colon == std::string::npos)
+        return false;
+    auto colon2 = listener.ip_addr.find(':', colon + 1);
+    std::string port = listener.ip_addr.substr(colon + 1, colon2 == std::string::npos ? colon2 : colon2 - colon - 1);
+    if (!parse_number(port.c_str(), listener.port) ||
+        (colon2 != std::string::npos && !parse_number(v + colon2 + 1, listener.block_size)))
+        return false;
+    listener.ip_addr.resize(colon);
+    return listener.port && listener.block_size;
+}
+
+/**
+ * @brief Parses a sink option value: <sink>:<block|drop|spill|off>[:<buffer limit>[:<nof threads>]]
+ * @param v option value
+ * @param server_params server params, whose sink options are set
+ * @return false on wrong value
+ */
+inline bool parse_sink(const char *v, server_t &server_params)
+{
+    edit::sink_options_t *sink = nullptr;
+    if (auto p = option_value(v, "console:"))
+        sink = &server_params.console, v = p;
+    else if (auto p = option_value(v, "file:"))
+        sink = &server_params.file, v = p;
+    else if (auto p = option_value(v, "forward:"))
+        sink = &server_params.forwarder, v = p;
+    else
+        return false;
+
+    if (option_value(v, "block"))
+        sink->overflow = edit::overflow_t::block;
+    else if (option_value(v, "drop"))
+        sink->overflow = edit::overflow_t::drop_oldest;
+    else if (option_value(v, "spill"))
+        sink->overflow = edit::overflow_t::spill;
+    else if (option_value(v, "off"))
+        sink->workers = 0;
+    else
+        return false;
+    if (!(v = strchr(v, ':')))
+        return true;
+    std::string limit(v + 1, strcspn(v + 1, ":"));
+    if (!parse_number(limit.c_str(), sink->limit))
+        return false;
+    if ((v = strchr(v + 1, ':')) && !parse_number(v + 1, sink->workers))
+        return false;
+    return true;
+}
+
+/**
+ * @brief Parses a fair scheduling option value:
+ *        <static weight>:<dynamic weight>[:<quantum>[:<flow limit>[:<sink credit>]]]
+ * @param v option value
+ * @param fair fair scheduling parameters, set enabled
+ * @return false on wrong value
+ */
+inline bool parse_fair(const char *v, edit::fair_options_t &fair)
+{
+    fair.enabled = true;
+    std::string value(v);
+    std::vector<std::string> fields;
+    for (size_t start = 0;;)
+    {
+        auto colon = value.find(':', start);
+        fields.push_back(value.substr(start, colon - start));
+        if (colon == std::string::npos)
+            break;
+        start = colon + 1;
+    }
+    if (fields.size() < 2 || fields.size() > 5 ||
+        !parse_number(fields[0].c_str(), fair.static_weight) ||
+        !parse_number(fields[1].c_str(), fair.dynamic_weight) ||
+        (fields.size() > 2 && !parse_number(fields[2].c_str(), fair.quantum)) ||
+        (fields.size() > 3 && !parse_number(fields[3].c_str(), fair.flow_limit)) ||
+        (fields.size() > 4 && !parse_number(fields[4].c_str(), fair.sink_credit)))
+        return false;
+    if (!fair.static_weight || !fair.dynamic_weight || !fair.quantum || !fair.flow_limit || !fair.sink_credit)
+        return false;
+    // a flow's quantum is <quantum> * <weight> bytes: it must not overflow
+    return fair.quantum <= std::numeric_limits<size_t>::max() / std::max(fair.static_weight, fair.dynamic_weight);
+}
+
+/**
+ * @brief Extracts '--' options from command line
+ * @param argc
+ * @param argv
+ * @param server_params
+ * @return nof positional arguments left in argv (including program name), or -1 on unknown option
+ */
+inline int get_options(int argc, char **argv, server_t &server_params)
+{
+    int n_pos = 1;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strncmp(argv[i], "--", 2))
+        {
+            argv[n_pos++] = argv[i]; // positional argument
+            continue;
+        }
+        if (!strcmp(argv[i], "--store"))
+            server_params.block_store = true;
+        else if (auto v = option_value(argv[i], "--keep-runs="))
+        {
+            if (!parse_number(v, server_params.retention.keep_runs))
+                return -1;
+        }
+        else if (auto v = option_value(argv[i], "--keep-bytes="))
+        {
+            if (!parse_number(v, server_params.retention.max_bytes))
+                return -1;
+        }
+        else if (auto v = option_value(argv[i], "--shards="))
+        {
+            if (!parse_number(v, server_params.shards))
+                return -1;
+        }
+        else if (auto v = option_value(argv[i], "--journal="))
+            server_params.journal = v;
+        else if (auto v = option_value(argv[i], "--capture="))
+            server_params.capture = v;
+        else if (auto v = option_value(argv[i], "--journal-interval="))
+        {
+            if (!parse_number(v, server_params.journal_interval_ms))
+                return -1;
+        }
+        else if (auto v = option_value(argv[i], "--journal-bytes="))
+        {
+            if (!parse_number(v, server_params.journal_bytes))
+                return -1;
+        }
+        else if (auto v = option_value(argv[i], "--journal-compact="))
+        {
+            if (!parse_number(v, server_params.journal_compact))
+                return -1;
+        }
+        else if (!strcmp(argv[i], "--low-latency"))
+            server_params.low_latency = true;
+        else if (auto v = option_value(argv[i], "--low-latency="))
+        {
+            server_params.low_latency = true;
+            if (!parse_number(v, server_params.spin_us))
+                return -1;
+        }
+        else if (!strcmp(argv[i], "--scale"))
+            server_params.scale = true;
+        else if (auto v = option_value(argv[i], "--log="))
+            server_params.log_path = v;
+        else if (auto v = option_value(argv[i], "--log-level="))
+        {
+            if (!parse_diag_level(v, server_params.log_level))
+                return -1;
+        }
+        else if (auto v = option_value(argv[i], "--log-rate="))
+        {
+            if (!parse_number(v, server_params.log_rate))
+                return -1;
+        }
+        else if (!strcmp(argv[i], "--fair"))
+            server_params.fair.enabled = true;
+        else if (auto v = option_value(argv[i], "--fair="))
+        {
+            if (!parse_fair(v, server_params.fair))
+                return -1;
+        }
+        else if (!strcmp(argv[i], "--intern"))
+            server_params.intern = 64 * 1024;
+        else if (auto v = option_value(argv[i], "--intern="))
+        {
+            if (!parse_number(v, server_params.intern))
+                return -1;
+        }
+        else if (auto v = option_value(argv[i], "--dynamic-cap="))
+        {
+            if (!parse_number(v, server_params.dynamic_cap))
+                return -1;
+        }
+        else if (!strcmp(argv[i], "--inline"))
+            server_params.inline_output = 1;
+        else if (auto v = option_value(argv[i], "--inline="))
+        {
+            if (!parse_number(v, server_params.inline_output) || !server_params.inline_output)
+                return -1;
+        }
+        else if (auto v = option_value(argv[i], "--fair-stats="))
+        {
+            if (!parse_number(v, server_params.fair_stats_s))
+                return -1;
+        }
+        else if (auto v = option_value(argv[i], "--mem-stats="))
+        {
+            if (!parse_number(v, server_params.mem_stats_s))
+                return -1;
+        }
+        else if (auto v = option_value(argv[i], "--sock-buf="))
+        {
+            if (!parse_number(v, server_params.sock_buf))
+                return -1;
+        }
+        else if (auto v = option_value(argv[i], "--forward="))
+            server_params.forward = v;
+        else if (auto v = option_value(argv[i], "--sink="))
+        {
+            if (!parse_sink(v, server_params))
+                return -1;
+        }
+        else
+        {
+            listener_t listener{};
+            const char *value = nullptr;
+            if ((value = option_value(argv[i], "--listen=")))
+                listener.kind = listener_t::Tcp;
+            else if ((value = option_value(argv[i], "--listen-unix=")))
+                listener.kind = listener_t::Unix;
+            else if ((value = option_value(argv[i], "--listen-udp=")))
+                listener.kind = listener_t::Udp;
+            else if ((value = option_value(argv[i], "--listen-shm=")))
+                listener.kind = listener_t::Shm;
+            if (!value || !parse_listener(value, listener))
+                return -1;
+            server_params.listeners.emplace_back(std::move(listener));
+        }
+    }
+    return n_pos;
+}
+
+/**
+ * @brief Extracts options and port, block_size, ip_addr from command line
  * @param argc
  * @param argv
  * @param server_params
@@ -61,6 +420,7 @@ inline bool get_params(int argc, char **argv, server_t &server_params)
 
     bool res = true;
 
+    argc = get_options(argc, argv, server_params);
     if (argc == 2)
         if (strstr(argv[1], "help") != nullptr)
             argc = -1;
@@ -88,13 +448,63 @@ inline bool get_params(int argc, char **argv, server_t &server_params)
         server_params.ip_addr = argv[3];
         break;
     default:
-        std::cout << "The use is: bulk_server <port number> <cmd block size> <ip address> \n"
-                     "or\tbulk_server <port number> <cmd block size>\n"
-                     "or\tbulk_server <port number>\n"
-                     "or\tbulk_server\n"
-                     "defaults: port number = 4507; block size = 5; ip address = 127.0.0.1 \n ";
+        std::cout << "The use is: bulk_server [options] <port number> <cmd block size> <ip address> \n"
+                     "or\tbulk_server [options] <port number> <cmd block size>\n"
+                     "or\tbulk_server [options] <port number>\n"
+                     "or\tbulk_server [options]\n"
+                     "defaults: port number = 4507; block size = 5; ip address = 127.0.0.1 \n"
+                     "options:\n"
+                     "\t--store\twrite blocks into binary block store 'log/blocks_<pid>.bst', see bulk_query\n"
+                     "\t--keep-runs=<n>\tkeep log directories of n previous runs (default 3)\n"
+                     "\t--keep-bytes=<n>\tlimit total size of kept log directories (default unlimited)\n"
+                     "\t--shards=<n>\tform dynamic blocks in n shard threads, each owning a part of connections\n"
+                     "\t--journal=<path>\twrite-ahead journal; commands of blocks not output before a crash are replayed on restart;\n"
+                     "\t\tmust be outside 'log'; with several listeners each uses '<path>.<listener>'\n"
+                     "\t--journal-interval=<ms>\tjournal group commit interval (default 2)\n"
+                     "\t--journal-bytes=<n>\tjournal group commit byte budget (default 262144)\n"
+                     "\t--journal-compact=<n>\tjournal size, over which its head of output commands is dropped (default 67108864, 0 - never)\n"
+                     "\t--capture=<path>\trecord producers' byte streams with arrival times for bulk_replay;\n"
+                     "\t\twith several listeners each uses '<path>.<listener>'\n"
+                     "\t--forward=<ip address>:<port number>\tforward 'block: ...' lines to a downstream aggregator\n"
+                     "\t--sink=<console|file|forward>:<block|drop|spill|off>[:<buffer limit>[:<nof threads>]]\n"
+                     "\t\ta sink's policy when its buffer is full: make input wait, drop the oldest block, spill to a file;\n"
+                     "\t\tdefaults: console:spill:1024:1, file:block:1024:2, forward:spill:1024:1\n"
+                     "\t--low-latency[=<spin us>]\tlow-latency profile, trades CPU for latency: TCP_NODELAY, TCP_QUICKACK,\n"
+                     "\t\tSO_BUSY_POLL, tuned socket buffers; io and library threads spin (default 50 us) before sleeping\n"
+                     "\t--scale\tscale mode for large counts of mostly idle connections: no coroutine per connection,\n"
+                     "\t\tsession states from a recycling pool, receive buffers taken from a shared pool for a read only\n"
+                     "\t--log=<path>\tdiagnostics destination (default stderr), apart from block output on stdout\n"
+                     "\t--log-level=<debug|info|warn|error>\tdiagnostics below the level are skipped (default info)\n"
+                     "\t--log-rate=<n>\tmax diagnostics per second per thread, errors are not limited (default 1000, 0 - unlimited)\n"
+                     "\t--fair[=<static weight>:<dynamic weight>[:<quantum>[:<flow limit>[:<sink credit>]]]]\tfair scheduling of blocks\n"
+                     "\t\tbefore the sinks: every connection's dynamic blocks and the static blocks are flows, served by deficit\n"
+                     "\t\tround-robin of <quantum> * <weight> bytes per round (default 1:1:4096:1048576:4); a 'block' sink gets\n"
+                     "\t\tat most <sink credit> blocks ahead of its threads, the rest queue here; a flow, which holds <flow limit>\n"
+                     "\t\tbytes in memory, spills its newer blocks to its spill file in the log directory\n"
+                     "\t--fair-stats=<seconds>\treport fairness metrics every <seconds>\n"
+                     "\t--intern[=<entries>]\tintern repeated commands: blocks share their texts from a bounded table\n"
+                     "\t\t(default 65536 entries, evicted by CLOCK); commands up to 15 chars are inline anyway\n"
+                     "\t--dynamic-cap=<bytes>\ta connection's dynamic block over <bytes> goes on in a spill file in the log directory\n"
+                     "\t\tand is read back by the sinks by chunks (default 0 - unlimited)\n"
+                     "\t--inline[=<batch>]\tinline output: blocks are written to the sinks by the thread, which forms them,\n"
+                     "\t\tby batches of <batch> blocks (default 1), a partial batch when idle; --fair is not used, and sinks' threads\n"
+                     "\t\tand policies are not used, but by the forwarder\n"
+                     "\t--mem-stats=<seconds>\treport memory per connection every <seconds> and at exit\n"
+                     "\t--sock-buf=<bytes>\tSO_RCVBUF/SO_SNDBUF in low-latency profile (default 1048576, 0 - system default)\n"
+                     "\t--listen=<ip address>:<port number>[:<cmd block size>]\tan extra listener with its own pipeline;\n"
+                     "\t\tmay be repeated; with several listeners output goes to 'log/<port number>'\n"
+                     "\t--listen-unix=<path>[:<cmd block size>]\tan extra AF_UNIX stream socket listener;\n"
+                     "\t\twith several listeners output goes to 'log/unix_<file name>'\n"
+                     "\t--listen-udp=<ip address>:<port number>[:<cmd block size>]\tan extra UDP listener:\n"
+                     "\t\tevery datagram carries \\n - delimited commands, all the producers share one connection;\n"
+                     "\t\twith several listeners output goes to 'log/udp_<port number>'\n"
+                     "\t--listen-shm=<path>[:<cmd block size>]\tan extra listener of shared-memory rings (see shm_ring.h),\n"
+                     "\t\tpassed over AF_UNIX socket; with several listeners output goes to 'log/shm_<file name>'\n";
         res = false;
         break;
     }
+    if (res)
+        server_params.listeners.insert(server_params.listeners.begin(),
+                                       listener_t{.ip_addr = server_params.ip_addr, .port = server_params.port, .block_size = server_params.block_size});
     return res;
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 
@@ -27,6 +28,32 @@ inline std::string this_pid_to_string()
     return std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
 }
 
-// Cmds input buffer type(commands are strings) * /
-using cmds_t = std::vector<std::string>;
-using pcmds_t = cmds_t *;
+/**
+ * @brief Commands delimiter of producers' input
+ */
+constexpr char msg_end = '\n';
+
+/**
+ * @brief Splits \n - delimited input into commands;
+ *        there can be several commands in the input or/and an unfinished command with no delimiter at the end
+ * @param s the input, up to DISCONNECT symbol
+ * @param cmd the unfinished command: continued by the input, keeps its unfinished rest
+ * @param cmds complete commands are appended to
+ */
+inline void split_cmds(std::string_view s, std::string &cmd, std::vector<std::string> &cmds)
+{
+    size_t prev_pos = 0;
+    while (prev_pos < s.size())
+    {
+        auto pos = s.find(msg_end, prev_pos);
+        if (pos == std::string::npos)
+        {
+            cmd.append(s, prev_pos, s.size() - prev_pos);
+            break;
+        }
+        cmd.append(s, prev_pos, pos - prev_pos);
+        prev_pos = pos + 1;
+        cmds.emplace_back(std::move(cmd));
+        cmd.clear();
+    }
+}
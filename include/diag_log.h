@@ -0,0 +1,106 @@
+/**
+ * @brief diag_log.h Contains definitions for 'bulk_server' diagnostics logger:
+ *        a thread formats a message into its own lock-free ring and never waits,
+ *        a background flusher writes the rings out to a destination apart from block output.
+ *        Messages are 'key=value' lines after an event name, e.g. "connected handle=5"
+ */
+#pragma once
+#include "spsc_ring.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Diagnostics levels
+ */
+enum class diag_level_t : uint8_t
+{
+    debug,
+    info,
+    warn,
+    error,
+    fatal // written out before the call returns: the caller exits
+};
+
+/**
+ * @brief Max message length; longer messages are truncated
+ */
+constexpr size_t diag_text_size = 496;
+
+/**
+ * @brief Capacity of a thread's ring; messages are dropped when it is full
+ */
+constexpr size_t diag_ring_capacity = 256;
+
+/**
+ * @brief A formatted message in a thread's ring
+ */
+struct diag_record_t
+{
+    uint64_t wall_ns;          // system_clock, ns since epoch
+    uint32_t thread;           // the thread's number in the logger
+    diag_level_t level;        // message level
+    uint16_t length;           // text length
+    char text[diag_text_size]; // message text, not null-terminated
+};
+
+/**
+ * @brief A thread's ring with its rate limit window; the flusher is the only consumer
+ */
+struct diag_buffer_t
+{
+    spsc_ring_t<diag_record_t, diag_ring_capacity> ring; // formatted messages
+    uint32_t thread;                                      // the thread's number in the logger
+    uint64_t window = 0;                                  // current rate limit window, s; owner thread only
+    unsigned in_window = 0;                               // messages in the window; owner thread only
+};
+
+/**
+ * @brief Asynchronous diagnostics logger
+ */
+class diag_log_t
+{
+private:
+    std::atomic<diag_level_t> threshold{diag_level_t::info}; // messages below it are skipped
+    unsigned rate = 1000;                                   // max messages per second per thread; 0 - unlimited
+    int fd = 2;                                             // destination, stderr by default
+    std::mutex registry_mtx;                                // guards buffers, taken once per thread
+    std::vector<std::unique_ptr<diag_buffer_t>> buffers;    // rings of all the threads, which logged
+    std::mutex drain_mtx;                                   // one consumer of the rings at a time
+    std::mutex flusher_mtx;                                 // flusher's sleep
+    std::condition_variable flusher_cv;                     // wakes flusher on errors and at stop
+    std::atomic<bool> urgent{false};                        // an error is logged: flush at once
+    bool stopping = false;                                  // flusher exits, guarded by flusher_mtx
+    std::thread flusher;                                    // the flusher thread
+    std::atomic<bool> running{false};                       // flusher runs: messages go through the rings
+    std::atomic<size_t> n_dropped{0};                       // messages dropped by full rings
+    std::atomic<size_t> n_suppressed{0};                    // messages suppressed by rate limit
+    diag_buffer_t &this_thread_buffer();                    // the calling thread's ring, registered on first use
+    void drain();                                           // writes out all the rings
+    void run();                                             // the flusher thread function
+
+public:
+    bool start(const std::string &path, diag_level_t level, unsigned _rate); // opens the destination, launches flusher
+    void log(diag_level_t level, const char *format, ...) __attribute__((format(printf, 3, 4)));
+    bool enabled(diag_level_t level) const { return level >= threshold.load(std::memory_order_relaxed); }
+    void stop(); // writes out the rest and joins flusher
+    ~diag_log_t() { stop(); }
+};
+
+/**
+ * @brief Globally accessible diagnostics logger item
+ */
+inline diag_log_t diag;
+
+/**
+ * @brief Parses a level name
+ * @param name debug, info, warn or error
+ * @param level parsed level
+ * @return false on unknown name
+ */
+bool parse_diag_level(const std::string &name, diag_level_t &level);
@@ -0,0 +1,37 @@
+/**
+ * @brief log_rotation.h Contains definitions for log directory rotation at 'bulk_server' start
+ *        and for background retention of the previous runs' directories
+ */
+#pragma once
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+/**
+ * @brief Rotated directories are named '<log_dir><rotated_infix><ns since epoch>'
+ */
+constexpr auto rotated_infix = ".old.";
+
+/**
+ * @brief Retention policy for rotated log directories
+ */
+struct retention_t
+{
+    size_t keep_runs = 3;    // nof the latest rotated runs to keep
+    uintmax_t max_bytes = 0; // max total size of kept runs; 0 - unlimited
+};
+
+/**
+ * @brief Atomically renames a non-empty log directory away and creates an empty one instead
+ * @param log_dir log directory path
+ * @return the path the old directory was renamed to, or empty path if there was nothing to rotate
+ */
+std::filesystem::path rotate_log_directory(const std::string &log_dir);
+
+/**
+ * @brief Starts a detached low-priority thread, which deletes rotated log directories
+ *        beyond the retention policy
+ * @param log_dir log directory path
+ * @param policy retention policy
+ */
+void start_retention(const std::string &log_dir, retention_t policy);
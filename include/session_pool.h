@@ -0,0 +1,126 @@
+/**
+ * @brief session_pool.h - memory pools of 'bulk_server' scale mode, where most of connections are idle:
+ *        receive buffers are taken only while a read is in progress, session states
+ *        and their pending operations come from recycling free lists.
+ *        The pools are used by the io thread only
+ */
+#pragma once
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+/**
+ * @brief Recycling allocator of session states and their pending asio operations:
+ *        freed blocks are kept in free lists by size class and reused, so that
+ *        a connection costs no malloc once the pool has grown to the connection count
+ */
+class frame_pool_t
+{
+private:
+    static constexpr size_t granule = 64;   // size classes are multiples of it
+    static constexpr size_t n_classes = 16; // bigger blocks go to operator new
+    struct free_block_t
+    {
+        free_block_t *next;
+    };
+    std::array<free_block_t *, n_classes> free_lists{}; // freed blocks by size class
+    size_t used_bytes = 0;                              // statistics: bytes allocated and not freed
+    size_t pooled_bytes = 0;                            // statistics: bytes in free lists
+
+    static size_t class_of(size_t n) { return (n + granule - 1) / granule - 1; }
+
+public:
+    void *allocate(size_t n)
+    {
+        auto c = class_of(n);
+        if (c >= n_classes)
+            return ::operator new(n);
+        used_bytes += (c + 1) * granule;
+        if (auto p = free_lists[c])
+        {
+            free_lists[c] = p->next;
+            pooled_bytes -= (c + 1) * granule;
+            return p;
+        }
+        return ::operator new((c + 1) * granule);
+    }
+    void deallocate(void *p, size_t n)
+    {
+        auto c = class_of(n);
+        if (c >= n_classes)
+        {
+            ::operator delete(p);
+            return;
+        }
+        used_bytes -= (c + 1) * granule;
+        pooled_bytes += (c + 1) * granule;
+        free_lists[c] = new (p) free_block_t{free_lists[c]};
+    }
+    size_t used() const { return used_bytes; }
+    size_t pooled() const { return pooled_bytes; }
+};
+
+/**
+ * @brief Globally accessible frame pool item
+ */
+inline frame_pool_t frame_pool;
+
+/**
+ * @brief Standard allocator over the frame pool; the associated allocator of scale-mode handlers
+ */
+template <typename T>
+struct frame_allocator_t
+{
+    using value_type = T;
+    frame_allocator_t() noexcept = default;
+    template <typename U>
+    frame_allocator_t(const frame_allocator_t<U> &) noexcept {}
+    T *allocate(size_t n) { return static_cast<T *>(frame_pool.allocate(n * sizeof(T))); }
+    void deallocate(T *p, size_t n) { frame_pool.deallocate(p, n * sizeof(T)); }
+    template <typename U>
+    bool operator==(const frame_allocator_t<U> &) const noexcept { return true; }
+    template <typename U>
+    bool operator!=(const frame_allocator_t<U> &) const noexcept { return false; }
+};
+
+/**
+ * @brief Receive buffers, shared by all the connections: a buffer is taken when the socket
+ *        is readable and given back after the read, so idle connections hold none
+ */
+class buffer_pool_t
+{
+private:
+    std::vector<std::unique_ptr<char[]>> free_bufs; // buffers not in use
+    size_t n_bufs = 0;                              // statistics: buffers allocated
+    size_t peak_in_use = 0;                         // statistics: max buffers in use at once
+
+public:
+    static constexpr size_t buf_size = 1024;
+    std::unique_ptr<char[]> take()
+    {
+        std::unique_ptr<char[]> buf;
+        if (free_bufs.empty())
+        {
+            buf.reset(new char[buf_size]);
+            ++n_bufs;
+        }
+        else
+        {
+            buf = std::move(free_bufs.back());
+            free_bufs.pop_back();
+        }
+        peak_in_use = std::max(peak_in_use, n_bufs - free_bufs.size());
+        return buf;
+    }
+    void give(std::unique_ptr<char[]> buf) { free_bufs.push_back(std::move(buf)); }
+    size_t allocated() const { return n_bufs; }
+    size_t peak() const { return peak_in_use; }
+};
+
+/**
+ * @brief Globally accessible receive buffer pool item
+ */
+inline buffer_pool_t buffer_pool;
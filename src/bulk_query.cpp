@@ -0,0 +1,100 @@
+/**
+ * @brief bulk_query.cpp
+ *        a tool to find command blocks in a binary block store, written by bulk_server
+ *        with '--store' option; answers time-range and connection queries
+ */
+#include "block_store.h"
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+/**
+ * @brief Converts a time argument to store's monotonic time;
+ *        "+<seconds>" is relative to the store opening, "<seconds>" is unix time
+ * @param arg time argument
+ * @param header store header, containing clock anchors
+ * @return monotonic time in ns
+ */
+uint64_t arg_to_mono_ns(const char *arg, const store_header_t &header)
+{
+    double seconds = std::atof(arg[0] == '+' ? arg + 1 : arg);
+    if (arg[0] == '+')
+        return header.mono_ns + uint64_t(seconds * 1e9);
+    int64_t wall_ns = int64_t(seconds * 1e9);
+    int64_t mono_ns = int64_t(header.mono_ns) + (wall_ns - int64_t(header.wall_ns));
+    return mono_ns < 0 ? 0 : uint64_t(mono_ns);
+}
+
+/**
+ * @brief Outputs a found block as a text line
+ * @param block found block
+ * @param header store header, containing clock anchors
+ */
+void print_block(const stored_block_t &block, const store_header_t &header)
+{
+    auto wall_ns = header.wall_ns + (block.mono_ns - header.mono_ns);
+    std::time_t secs = wall_ns / 1000000000;
+    std::tm tm{};
+    localtime_r(&secs, &tm);
+
+    std::string ss;
+    for (auto &c : block.cmds)
+        ss += (ss.empty() ? "" : ", ") + c;
+
+    std::cout << std::put_time(&tm, "%F %T") << "." << std::setw(6) << std::setfill('0')
+              << (wall_ns % 1000000000) / 1000 << " seq=" << block.seq << " conn=";
+    if (block.handle == edit::static_handle)
+        std::cout << "static";
+    else
+        std::cout << block.handle;
+    std::cout << " block: " << ss << "\n";
+}
+
+/**
+ * @brief Runs a query against the store
+ * @param argc
+ * @param argv store path, then optional --from <time>, --to <time>, --conn <handle|static>
+ * @return 0 on success
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 2 || strstr(argv[1], "help") != nullptr)
+    {
+        std::cout << "The use is: bulk_query <store.bst> [--from <time>] [--to <time>] [--conn <handle|static>]\n"
+                     "time is unix time in seconds, or +<seconds> from the store start\n";
+        return 0;
+    }
+
+    block_store_reader_t reader;
+    if (!reader.open(argv[1]))
+    {
+        std::cerr << "Can't open block store " << argv[1] << "\n";
+        return 1;
+    }
+
+    store_query_t q;
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+        if (!strcmp(argv[i], "--from"))
+            q.from_ns = arg_to_mono_ns(argv[i + 1], reader.header);
+        else if (!strcmp(argv[i], "--to"))
+            q.to_ns = arg_to_mono_ns(argv[i + 1], reader.header);
+        else if (!strcmp(argv[i], "--conn"))
+        {
+            q.by_handle = true;
+            q.handle = strcmp(argv[i + 1], "static") ? std::strtoull(argv[i + 1], nullptr, 10) : edit::static_handle;
+        }
+        else
+        {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return 1;
+        }
+    }
+
+    auto found = reader.query(q, [&](const stored_block_t &b)
+                              { print_block(b, reader.header); });
+    std::cerr << found << " blocks found\n";
+    return 0;
+}
@@ -0,0 +1,249 @@
+/**
+ * @brief bulk_replay.cpp
+ *        a tool to replay a traffic capture, written by bulk_server with '--capture' option,
+ *        directly into 'async' library: no sockets, no clients. Reports throughput and output latency
+ */
+#include "common.h"
+#include "async.h"
+#include "block_store.h"
+#include "capture.h"
+#include "cmd_output.h"
+#include "sink.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Wraps the file sink: measures output latency of every block,
+ *        from its forming to the end of its file output
+ */
+class timed_sink_t : public sink_t
+{
+private:
+    std::unique_ptr<sink_t> sink;  // the measured sink
+    std::mutex mtx;                // the sink's threads add samples concurrently
+    std::vector<uint64_t> samples; // latencies, ns
+
+public:
+    explicit timed_sink_t(std::unique_ptr<sink_t> _sink) : sink(std::move(_sink)) {}
+    std::string name() const override { return sink->name(); }
+    bool open() override { return sink->open(); }
+    void write(const cmd_block_t &block) override
+    {
+        sink->write(block);
+        auto latency = cmd_block_t::mono_now_ns() - block.mono_ns;
+        std::lock_guard g(mtx);
+        samples.push_back(latency);
+    }
+    void stop() override { sink->stop(); }
+    void close() override { sink->close(); }
+    std::vector<uint64_t> take_samples() // after the instance terminates
+    {
+        std::lock_guard g(mtx);
+        return std::move(samples);
+    }
+};
+
+/**
+ * @brief A connection of the captured run, replayed
+ */
+struct replay_conn_t
+{
+    edit::connection_handle_t handle; // the replay's connection handle
+    std::string cmd;                  // unfinished command, continued by the next data
+};
+
+/**
+ * @brief Replay parameters, given in the command string
+ */
+struct replay_params_t
+{
+    const char *capture = nullptr;        // capture path
+    bool paced = false;                   // '--paced': keep recorded arrival times
+    double speed = 1;                     // '--speed': pacing speed-up
+    size_t block_size = 0;                // '--block-size': 0 - the captured one
+    size_t shards = 0;                    // '--shards': library's sharded mode
+    bool block_store = false;             // '--store': file output into block store
+    bool console = false;                 // '--console': console output is off by default
+    std::string log_dir = "./replay_log"; // '--log-dir': output directory, its outputs are removed before the replay
+};
+
+/**
+ * @brief Removes the library's outputs of a previous replay from the output directory:
+ *        'bulk*.log' block files, 'blocks_*' block store files and 'spill_*.tmp' sink spill files.
+ *        Other files and subdirectories are left as they are, so '--log-dir' may name any directory
+ * @param dir the output directory
+ */
+void remove_outputs(const std::string &dir)
+{
+    auto ends_with = [](const std::string &s, std::string_view end)
+    { return s.size() >= end.size() && s.compare(s.size() - end.size(), end.size(), end) == 0; };
+    std::error_code ec;
+    for (const auto &entry : std::filesystem::directory_iterator(dir, ec))
+    {
+        if (!entry.is_regular_file(ec))
+            continue;
+        auto name = entry.path().filename().string();
+        if ((name.starts_with("bulk") && ends_with(name, ".log"))
+            || (name.starts_with("blocks_") && (ends_with(name, store_ext) || ends_with(name, index_ext)))
+            || (name.starts_with("spill_") && ends_with(name, ".tmp")))
+            std::filesystem::remove(entry.path(), ec);
+    }
+}
+
+/**
+ * @brief Outputs a latency percentile
+ */
+void print_percentile(const char *name, const std::vector<uint64_t> &sorted, double p)
+{
+    auto i = std::min(sorted.size() - 1, size_t(p * sorted.size()));
+    std::cout << " " << name << " " << sorted[i] / 1000.0;
+}
+
+/**
+ * @brief Replays a capture and reports results
+ * @param argc
+ * @param argv capture path, then options
+ * @return 0 on success
+ */
+int main(int argc, char **argv)
+{
+    if (argc < 2 || strstr(argv[1], "help") != nullptr)
+    {
+        std::cout << "The use is: bulk_replay <capture> [--paced] [--speed <x>] [--block-size <n>] [--shards <n>]\n"
+                     "\t\t[--store] [--console] [--log-dir <path>]\n"
+                     "replays a capture of 'bulk_server --capture=<path>' into the library as fast as possible,\n"
+                     "or with recorded arrival times ('--paced', sped up by '--speed');\n"
+                     "block size is the captured one by default; output goes to './replay_log', console output is off\n";
+        return 0;
+    }
+
+    replay_params_t params;
+    params.capture = argv[1];
+    for (int i = 2; i < argc; ++i)
+    {
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--paced"))
+            params.paced = true;
+        else if (!strcmp(argv[i], "--store"))
+            params.block_store = true;
+        else if (!strcmp(argv[i], "--console"))
+            params.console = true;
+        else if (!strcmp(argv[i], "--speed") && has_value)
+            params.speed = std::atof(argv[++i]);
+        else if (!strcmp(argv[i], "--block-size") && has_value)
+            params.block_size = std::strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--shards") && has_value)
+            params.shards = std::strtoull(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--log-dir") && has_value)
+            params.log_dir = argv[++i];
+        else
+        {
+            std::cerr << "Unknown option " << argv[i] << "\n";
+            return 1;
+        }
+    }
+    if (params.speed <= 0)
+        params.speed = 1;
+
+    capture_reader_t reader;
+    if (!reader.open(params.capture))
+    {
+        std::cerr << "Can't open capture " << params.capture << "\n";
+        return 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(params.log_dir, ec);
+    remove_outputs(params.log_dir);
+
+    edit::options_t options;
+    options.block_size = params.block_size ? params.block_size : reader.header.block_size;
+    options.log_dir = params.log_dir.c_str();
+    options.file_format = params.block_store ? edit::file_format_t::block_store : edit::file_format_t::per_block;
+    options.shards = params.shards;
+    if (!params.console)
+        options.console.workers = 0;
+    auto file = options.file;
+    options.file.workers = 0; // replaced by the timed one
+
+    edit::instance_t instance(options);
+    auto timed = std::make_unique<timed_sink_t>(std::make_unique<file_sink_t>(options.file_format, params.log_dir));
+    auto &probe = *timed;
+    instance.add_sink(std::move(timed), file);
+
+    std::unordered_map<edit::connection_handle_t, replay_conn_t> conns;
+    size_t n_records = 0, n_conns = 0, n_cmds = 0, n_bytes = 0;
+    std::vector<std::string> cmds;
+    capture_record_t record;
+
+    auto start = std::chrono::steady_clock::now();
+    while (reader.next(record))
+    {
+        ++n_records;
+        if (params.paced)
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(uint64_t(record.time_ns / params.speed)));
+
+        auto it = conns.find(record.handle);
+        if (record.type == capture_record_t::Connect || (it == conns.end() && record.type == capture_record_t::Data))
+        {
+            if (it != conns.end())
+                instance.disconnect(it->second.handle);
+            it = conns.insert_or_assign(record.handle, replay_conn_t{instance.connect(), {}}).first;
+            ++n_conns;
+        }
+        if (record.type == capture_record_t::Data)
+        {
+            std::string_view s(record.data);
+            n_bytes += s.size();
+            auto pos = s.find(edit::DISCONNECT);
+            split_cmds(s.substr(0, pos), it->second.cmd, cmds);
+            for (auto &c : cmds)
+                instance.receive(it->second.handle, c);
+            n_cmds += cmds.size();
+            cmds.clear();
+            if (pos == std::string_view::npos)
+                continue;
+        }
+        if (it != conns.end() && record.type != capture_record_t::Connect) // DISCONNECT symbol or Disconnect record
+        {
+            instance.disconnect(it->second.handle);
+            conns.erase(it);
+        }
+    }
+    for (auto &[_, conn] : conns)
+        instance.disconnect(conn.handle);
+    auto replayed = std::chrono::steady_clock::now();
+    instance.terminate();
+    auto drained = std::chrono::steady_clock::now();
+
+    auto seconds = [&](auto t)
+    { return std::chrono::duration<double>(t - start).count(); };
+    auto samples = probe.take_samples();
+    std::sort(samples.begin(), samples.end());
+
+    std::cout << std::fixed << std::setprecision(3)
+              << "replayed " << n_records << " records: " << n_conns << " connections, " << n_cmds << " commands, "
+              << n_bytes << " bytes in " << seconds(replayed) << " s, output drained in " << seconds(drained) << " s\n"
+              << "throughput: " << n_cmds / seconds(drained) << " commands/s, "
+              << n_bytes / seconds(drained) / (1024 * 1024) << " MiB/s\n"
+              << "output latency, us, of " << samples.size() << " blocks:";
+    if (!samples.empty())
+    {
+        print_percentile("p50", samples, 0.5);
+        print_percentile("p90", samples, 0.9);
+        print_percentile("p99", samples, 0.99);
+        print_percentile("max", samples, 1);
+    }
+    std::cout << "\n";
+    return 0;
+}
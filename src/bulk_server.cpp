@@ -4,13 +4,25 @@
  */
 #include "common.h"
 #include "async.h"
+#include "async_asio.h"
 #include "bulk_server.h"
 #include "cmd_output.h"
+#include "shm_ring.h"
+#include <boost/asio/posix/stream_descriptor.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
 #include <cstdlib>
 #include <memory>
 #include <utility>
 #include <string>
 #include <filesystem>
+#include <chrono>
+#include <type_traits>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 /**
  * @brief Handles CTRL-C signal to softly shutdown the server
@@ -21,124 +33,666 @@ void SIGINT_handler([[maybe_unused]] int _signal)
     context.stop(); // stop the coro loop
 }
 
+/**
+ * @brief Re-arms TCP_QUICKACK: the kernel clears it, so it is set after every read
+ * @param socket the socket
+ */
+template <typename Socket>
+void quickack(Socket &socket)
+{
+#ifdef TCP_QUICKACK
+    if constexpr (std::is_same_v<typename Socket::protocol_type, tcp_t>)
+    {
+        int one = 1;
+        setsockopt(socket.native_handle(), IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+    }
+#endif
+}
+
+/**
+ * @brief Applies the low-latency profile to a socket: TCP_NODELAY, TCP_QUICKACK, SO_BUSY_POLL and socket buffers;
+ *        options, which the socket type or the system does not support, are skipped
+ * @param socket the socket
+ */
+template <typename Socket>
+void tune_socket(Socket &socket)
+{
+    if (!server.low_latency)
+        return;
+    boost::system::error_code ec;
+    if (server.sock_buf)
+    {
+        socket.set_option(asio::socket_base::receive_buffer_size(server.sock_buf), ec);
+        socket.set_option(asio::socket_base::send_buffer_size(server.sock_buf), ec);
+    }
+#ifdef SO_BUSY_POLL
+    int busy_poll = server.spin_us; // raising it above net.core.busy_read needs CAP_NET_ADMIN
+    setsockopt(socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll));
+#endif
+    if constexpr (std::is_same_v<typename Socket::protocol_type, tcp_t>)
+        socket.set_option(tcp_t::no_delay(true), ec);
+    quickack(socket);
+}
+
 /**
  * @brief A coro to process the input from connected client
+ * @tparam Socket stream socket type: TCP or AF_UNIX
  * @param _socket the socket corresponding to the client
+ * @param instance library instance of the listener
  * @param handle connection handle
- * @param block_size commands block size
+ * @param capture traffic capture, or nullptr
  * @return nothing
  */
-asio::awaitable<void> run_session(tcp_t::socket _socket, edit::connection_handle_t handle, [[maybe_unused]] size_t block_size)
+template <typename Socket>
+asio::awaitable<void> run_session(Socket _socket, edit::instance_t &instance, edit::connection_handle_t handle,
+                                  capture_writer_t *capture)
 {
 
     constexpr size_t buf_size = 1024;
     std::string cmd;
     std::string line(buf_size, '\0');
+    std::vector<std::string> cmds; // complete commands of one read, passed to the library at once
 
     while (true)
     {
 
-        [[maybe_unused]] auto n_read = co_await _socket.async_read_some(asio::buffer(line), asio::use_awaitable);
-        if (!n_read)
-        {
-            std::cerr << "Zero bytes read " << "\n";
-            quick_exit(1);
-        }
+        boost::system::error_code ec;
+        auto n_read = co_await _socket.async_read_some(asio::buffer(line), asio::redirect_error(asio::use_awaitable, ec));
+        if (ec) // closed with no DISCONNECT symbol: the unfinished command (no '\n' yet) is discarded
+            n_read = 0;
+        else if (server.low_latency)
+            quickack(_socket);
 
         // Begin processing \n - delimited input string
-        std::string_view s(line.begin(), line.begin() + n_read);
+        std::string_view s(line.data(), n_read);
+        if (capture && n_read)
+            capture->data(handle, s);
 
         // Process DISCONNECT symbol, received from client
-        auto pos = line.find(edit::DISCONNECT);
-        bool disconnect = (pos != std::string::npos);
-        if (disconnect)
+        auto pos = s.find(edit::DISCONNECT);
+        bool disconnect = ec || (pos != std::string::npos);
+        if (pos != std::string::npos)
             s = s.substr(0, pos);
 
-        // There can be several \n - delimited commands in the input string
-        // or/and an unfinished command whith no delimiter at the end
-        auto prev_pos = pos = 0;
+        split_cmds(s, cmd, cmds);
 
-        while (prev_pos < s.size())
+        // Hand the commands over without blocking the io thread;
+        // the coro resumes when the library accepts them
+        if (!cmds.empty())
         {
-            pos = s.find("\n", prev_pos);
-            if (pos == std::string::npos)
-            {
-                cmd.append(s, prev_pos, s.size() - prev_pos);
-                break;
-            }
-            cmd.append(s, prev_pos, pos - prev_pos);
-            prev_pos = pos + 1;
-            edit::receive(handle, cmd);
-            cmd.clear();
+            co_await edit::async_receive(instance, handle, std::move(cmds));
+            cmds.clear();
         }
-        // On DISCONNECT close socket and return
+        // On DISCONNECT or a lost connection close socket and return
         if (disconnect)
         {
+            if (ec && !cmd.empty())
+                diag.log(diag_level_t::warn, "unfinished_cmd_dropped handle=%zu bytes=%zu", handle, cmd.size());
             try
             {
                 _socket.close();
             }
             catch (const std::exception &ex)
             {
-                std::cerr << "Exception: " << ex.what() << "\n";
+                diag.log(diag_level_t::fatal, "socket_close_error handle=%zu what=\"%s\"", handle, ex.what());
                 quick_exit(1);
             }
-            edit::disconnect(handle);
-            std::cout << "disconnected " << handle << "\n";
+            co_await edit::async_disconnect(instance, handle);
+            if (capture)
+                capture->disconnect(handle);
+            diag.log(diag_level_t::info, "disconnected handle=%zu", handle);
             co_return;
         }
     }
 }
 
+/**
+ * @brief A scale-mode session: a small state object in place of a coroutine. While the connection is idle,
+ *        it holds the socket and the unfinished command only, and waits for readability by an operation,
+ *        allocated from the frame pool; a receive buffer is taken from the buffer pool for a read only
+ * @tparam Socket stream socket type: TCP or AF_UNIX
+ */
+template <typename Socket>
+class scale_session_t
+{
+private:
+    Socket socket;                    // the client's socket, non-blocking
+    edit::instance_t &instance;       // library instance of the listener
+    edit::connection_handle_t handle; // connection handle
+    capture_writer_t *capture;        // traffic capture, or nullptr
+    std::string cmd;                  // the unfinished command, mostly empty
+
+    /**
+     * @brief A completion handler, which continues the session on the io thread;
+     *        operations, which it waits for, are allocated from the frame pool
+     */
+    struct resume_t
+    {
+        using allocator_type = frame_allocator_t<void>;
+        using executor_type = asio::io_context::executor_type;
+        scale_session_t *session;
+        void (scale_session_t::*step)();
+        allocator_type get_allocator() const noexcept { return {}; }
+        executor_type get_executor() const noexcept { return context.get_executor(); }
+        void operator()(const boost::system::error_code &ec = {}) const
+        {
+            if (ec)
+                session->close(); // the connection is broken or the server stops
+            else
+                (session->*step)();
+        }
+    };
+
+    scale_session_t(Socket _socket, edit::instance_t &_instance, edit::connection_handle_t _handle, capture_writer_t *_capture)
+        : socket(std::move(_socket)), instance(_instance), handle(_handle), capture(_capture)
+    {
+        socket.non_blocking(true);
+    }
+
+    /**
+     * @brief Waits until the socket is readable
+     */
+    void wait()
+    {
+        socket.async_wait(Socket::wait_read, resume_t{this, &scale_session_t::read});
+    }
+
+    /**
+     * @brief Reads the socket with a pooled buffer and hands the commands over to the library
+     */
+    void read()
+    {
+        auto buf = buffer_pool.take();
+        boost::system::error_code ec;
+        auto n_read = socket.read_some(asio::buffer(buf.get(), buffer_pool_t::buf_size), ec);
+        if (ec == asio::error::would_block)
+        {
+            buffer_pool.give(std::move(buf));
+            wait();
+            return;
+        }
+        if (ec || !n_read) // closed with no DISCONNECT symbol
+        {
+            buffer_pool.give(std::move(buf));
+            close();
+            return;
+        }
+        if (server.low_latency)
+            quickack(socket);
+
+        std::string_view s(buf.get(), n_read);
+        if (capture)
+            capture->data(handle, s);
+        auto pos = s.find(edit::DISCONNECT);
+        bool disconnect = (pos != std::string::npos);
+        if (disconnect)
+            s = s.substr(0, pos);
+        std::vector<std::string> cmds;
+        split_cmds(s, cmd, cmds);
+        buffer_pool.give(std::move(buf));
+
+        auto next = disconnect ? &scale_session_t::close : &scale_session_t::wait;
+        if (cmds.empty())
+            (this->*next)();
+        else
+            edit::async_receive(instance, handle, std::move(cmds), resume_t{this, next});
+    }
+
+    /**
+     * @brief Closes the socket and disconnects from the library
+     */
+    void close()
+    {
+        boost::system::error_code ec;
+        socket.close(ec);
+        edit::async_disconnect(instance, handle, resume_t{this, &scale_session_t::destroy});
+    }
+
+    /**
+     * @brief Gives the session's memory back to the frame pool
+     */
+    void destroy()
+    {
+        if (capture)
+            capture->disconnect(handle);
+        diag.log(diag_level_t::info, "disconnected handle=%zu", handle);
+        this->~scale_session_t();
+        frame_pool.deallocate(this, sizeof(scale_session_t));
+    }
+
+public:
+    /**
+     * @brief Creates a session in the frame pool and starts it
+     * @param socket the socket corresponding to the client
+     * @param instance library instance of the listener
+     * @param handle connection handle
+     * @param capture traffic capture, or nullptr
+     */
+    static void start(Socket socket, edit::instance_t &instance, edit::connection_handle_t handle, capture_writer_t *capture)
+    {
+        auto session = new (frame_pool.allocate(sizeof(scale_session_t))) scale_session_t(std::move(socket), instance, handle, capture);
+        session->wait();
+    }
+};
+
+/**
+ * @brief A coro to process datagrams of UDP listener: all the producers share one connection;
+ *        datagrams are taken by batches with 'recvmmsg' once the socket is readable,
+ *        and the commands of a batch are passed to the library at once.
+ *        Every datagram carries complete commands: a command with no delimiter ends with the datagram,
+ *        so a datagram is captured with the delimiter appended
+ * @param context asio io_context
+ * @param listener listener parameters and library instance
+ * @return nothing
+ */
+asio::awaitable<void> run_udp_server(asio::io_context &context, listener_t &listener)
+{
+    try
+    {
+        udp_t::socket socket(context, udp_t::endpoint{asio::ip::make_address_v4(listener.ip_addr), listener.port});
+        tune_socket(socket);
+        auto handle = co_await edit::async_connect(*listener.instance);
+        if (listener.capture)
+            listener.capture->connect(handle);
+
+        std::vector<char> bufs(udp_batch_size * udp_datagram_size);
+        std::vector<iovec> iovs(udp_batch_size);
+        std::vector<mmsghdr> msgs(udp_batch_size);
+        for (size_t i = 0; i < udp_batch_size; ++i)
+            iovs[i] = iovec{.iov_base = bufs.data() + i * udp_datagram_size, .iov_len = udp_datagram_size};
+
+        std::string cmd;
+        std::vector<std::string> cmds; // commands of one batch
+        uint64_t n_truncated = 0;      // datagrams over udp_datagram_size, dropped
+        while (true)
+        {
+            co_await socket.async_wait(udp_t::socket::wait_read, asio::use_awaitable);
+
+            // Drain the socket; 'recvmmsg' fills 'msg_len' of every message taken
+            for (int n = udp_batch_size; n == static_cast<int>(udp_batch_size);)
+            {
+                for (size_t i = 0; i < udp_batch_size; ++i)
+                {
+                    msgs[i] = mmsghdr{};
+                    msgs[i].msg_hdr.msg_iov = &iovs[i];
+                    msgs[i].msg_hdr.msg_iovlen = 1;
+                }
+                n = recvmmsg(socket.native_handle(), msgs.data(), udp_batch_size, MSG_DONTWAIT, nullptr);
+                for (int i = 0; i < n; ++i)
+                {
+                    if (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) // its tail is lost: no partial commands from it
+                    {
+                        diag.log(diag_level_t::warn, "udp_datagram_truncated port=%u limit=%zu dropped=%llu",
+                                 unsigned(listener.port), udp_datagram_size, (unsigned long long)++n_truncated);
+                        continue;
+                    }
+                    std::string_view s(static_cast<const char *>(iovs[i].iov_base), msgs[i].msg_len);
+                    s = s.substr(0, s.find(edit::DISCONNECT)); // no connection to close: the symbol just ends the datagram
+                    if (listener.capture && !s.empty())
+                        listener.capture->data(handle, s.back() == msg_end ? std::string(s) : std::string(s) + msg_end);
+                    split_cmds(s, cmd, cmds);
+                    if (!cmd.empty())
+                        cmds.emplace_back(std::move(cmd));
+                    cmd.clear();
+                }
+            }
+
+            if (!cmds.empty())
+            {
+                co_await edit::async_receive(*listener.instance, handle, std::move(cmds));
+                cmds.clear();
+            }
+        }
+    }
+    catch (const std::exception &ex)
+    {
+        diag.log(diag_level_t::error, "udp_listener_error port=%u what=\"%s\"", unsigned(listener.port), ex.what());
+    }
+}
+
+/**
+ * @brief Max nof commands taken from a shared-memory ring at once
+ */
+constexpr size_t shm_batch_size = 1024;
+
+/**
+ * @brief A producer, which does not pass its ring's descriptors so long after connecting, is dropped
+ */
+constexpr auto shm_handshake_timeout = std::chrono::seconds(5);
+
+/**
+ * @brief A coro to process the commands of a shared-memory ring:
+ *        takes them by batches while there are any, sleeps on the ring's doorbell otherwise
+ * @param ring the ring
+ * @param instance library instance of the listener
+ * @param handle connection handle
+ * @param capture traffic capture, or nullptr: a batch is captured as \n - delimited commands
+ * @return nothing
+ */
+asio::awaitable<void> run_shm_session(std::unique_ptr<shm_consumer_t> ring, edit::instance_t &instance, edit::connection_handle_t handle,
+                                      capture_writer_t *capture)
+{
+    asio::posix::stream_descriptor doorbell(co_await asio::this_coro::executor, ::dup(ring->doorbell()));
+    std::vector<std::string> cmds;
+    while (true)
+    {
+        if (ring->fetch(cmds, shm_batch_size))
+        {
+            if (capture)
+            {
+                std::string bytes;
+                for (auto &c : cmds)
+                    (bytes += c) += msg_end;
+                capture->data(handle, bytes);
+            }
+            co_await edit::async_receive(instance, handle, std::move(cmds));
+            cmds.clear();
+            continue;
+        }
+        if (ring->closed())
+        {
+            if (ring->malformed())
+                diag.log(diag_level_t::warn, "malformed_shm_ring handle=%zu", handle);
+            break;
+        }
+        if (ring->sleep())
+        {
+            co_await doorbell.async_wait(asio::posix::stream_descriptor::wait_read, asio::use_awaitable);
+            ring->wake();
+        }
+    }
+    co_await edit::async_disconnect(instance, handle);
+    if (capture)
+        capture->disconnect(handle);
+    diag.log(diag_level_t::info, "disconnected handle=%zu", handle);
+}
+
+/**
+ * @brief A coro to take a shared-memory ring from a connected producer: waits for the ring's descriptors
+ *        at most shm_handshake_timeout, then the ring acts as a connection.
+ *        Every producer has its own, so a silent one does not hold the others
+ * @param context asio io_context
+ * @param listener listener parameters and library instance
+ * @param client the producer's AF_UNIX connection
+ * @return nothing
+ */
+asio::awaitable<void> run_shm_handshake(asio::io_context &context, listener_t &listener, std::shared_ptr<unix_t::socket> client)
+{
+    try
+    {
+        asio::steady_timer timer(context);
+        timer.expires_after(shm_handshake_timeout);
+        timer.async_wait([client](const boost::system::error_code &ec)
+                         {
+                             if (!ec)
+                                 client->cancel(); });
+        co_await client->async_wait(unix_t::socket::wait_read, asio::use_awaitable);
+        timer.cancel();
+
+        int mem_fd, bell_fd;
+        auto ring = std::make_unique<shm_consumer_t>();
+        if (!shm_receive_fds(client->native_handle(), mem_fd, bell_fd) || !ring->attach(mem_fd, bell_fd))
+        {
+            diag.log(diag_level_t::warn, "wrong_shm_ring path=%s", listener.ip_addr.c_str());
+            co_return;
+        }
+        auto handle = co_await edit::async_connect(*listener.instance);
+        if (listener.capture)
+            listener.capture->connect(handle);
+
+        client->close(); // the ring is passed
+        diag.log(diag_level_t::info, "connected handle=%zu", handle);
+        asio::co_spawn(context, run_shm_session(std::move(ring), *listener.instance, handle, listener.capture.get()), asio::detached);
+    }
+    catch (const std::exception &ex)
+    {
+        diag.log(diag_level_t::warn, "shm_handshake_error path=%s what=\"%s\"", listener.ip_addr.c_str(), ex.what());
+    }
+}
+
+/**
+ * @brief A coro to accept shared-memory rings: a producer connects to AF_UNIX socket
+ *        and passes the ring's descriptors, then the ring acts as a connection
+ * @param context asio io_context
+ * @param listener listener parameters and library instance
+ * @return nothing
+ */
+asio::awaitable<void> run_shm_server(asio::io_context &context, listener_t &listener)
+{
+    try
+    {
+        unix_t::acceptor acceptor(context, unix_t::endpoint{listener.ip_addr});
+        while (true)
+        {
+            unix_t::socket client = co_await acceptor.async_accept(asio::use_awaitable);
+            asio::co_spawn(context, run_shm_handshake(context, listener, std::make_shared<unix_t::socket>(std::move(client))),
+                           asio::detached);
+        }
+    }
+    catch (const std::exception &ex)
+    {
+        diag.log(diag_level_t::error, "shm_listener_error path=%s what=\"%s\"", listener.ip_addr.c_str(), ex.what());
+    }
+}
+
 /**
  * @brief A coro to process connection request from clients
  *        establishes connection and run session coro for it
+ * @tparam Protocol stream protocol: TCP or AF_UNIX
  * @param context asio io_context
- * @param server server parameters structure
+ * @param listener listener parameters and library instance
+ * @param endpoint the endpoint to listen at
  * @return nothing
  */
-asio::awaitable<void> run_server(asio::io_context &context, server_t &server)
+template <typename Protocol>
+asio::awaitable<void> run_server(asio::io_context &context, listener_t &listener, typename Protocol::endpoint endpoint)
 {
 
     try
     {
-        tcp_t::acceptor acceptor(context, tcp_t::endpoint{asio::ip::make_address_v4(server.ip_addr), server.port});
+        typename Protocol::acceptor acceptor(context, endpoint);
         while (true)
         {
-            tcp_t::socket client = co_await acceptor.async_accept(asio::use_awaitable);
-            auto handle = edit::connect(server.block_size);
+            typename Protocol::socket client = co_await acceptor.async_accept(asio::use_awaitable);
+            tune_socket(client);
+            auto handle = co_await edit::async_connect(*listener.instance);
+            if (listener.capture)
+                listener.capture->connect(handle);
 
-            std::cout << "connected " << handle << "\n";
-            asio::co_spawn(context, run_session(std::move(client), handle, server.block_size), asio::detached);
+            diag.log(diag_level_t::info, "connected handle=%zu", handle);
+            if (server.scale)
+                scale_session_t<typename Protocol::socket>::start(std::move(client), *listener.instance, handle, listener.capture.get());
+            else
+                asio::co_spawn(context, run_session(std::move(client), *listener.instance, handle, listener.capture.get()), asio::detached);
         }
     }
     catch (const std::exception &ex)
     {
-        std::cerr << "Exception: " << ex.what() << "\n";
+        diag.log(diag_level_t::error, "listener_error listener=%s what=\"%s\"", listener.name().c_str(), ex.what());
     }
     auto a = 0;
     (void)a;
 }
 
 /**
- * @brief Menages log-directory before server start
+ * @brief Menages log-directory before server start:
+ *        renames the previous run's directory away and leaves its deletion
+ *        to a background thread, so the server starts accepting at once
+ * @param policy retention policy for previous runs' directories
+ */
+void clean_directory(retention_t policy)
+{
+    // Clear console
+    std::cout << "\033[2J\033[H" << std::flush;
+
+    rotate_log_directory(edit::log_directory);
+    start_retention(edit::log_directory, policy);
+}
+
+/**
+ * @brief Reports memory of connections: the library's input contexts, the server's sessions,
+ *        pending operations and receive buffers, and the process RSS; the command intern table, if enabled
+ */
+void report_memory()
+{
+    edit::instance_stats_t total;
+    edit::intern_stats_t interned;
+    for (auto &listener : server.listeners)
+    {
+        auto stats = listener.instance->stats();
+        total.connections += stats.connections;
+        total.contexts += stats.contexts;
+        total.context_bytes += stats.context_bytes;
+        total.spilled_blocks += stats.spilled_blocks;
+        auto intern = listener.instance->interning();
+        interned.entries += intern.entries;
+        interned.bytes += intern.bytes;
+        interned.hits += intern.hits;
+        interned.misses += intern.misses;
+        interned.evictions += intern.evictions;
+    }
+    size_t pages = 0, rss_pages = 0;
+    if (auto statm = std::fopen("/proc/self/statm", "r"))
+    {
+        if (std::fscanf(statm, "%zu %zu", &pages, &rss_pages) != 2)
+            rss_pages = 0;
+        std::fclose(statm);
+    }
+    size_t rss = rss_pages * sysconf(_SC_PAGESIZE);
+    size_t tracked = frame_pool.used() + total.context_bytes + buffer_pool.allocated() * buffer_pool_t::buf_size;
+
+    auto per_connection = [&](size_t bytes)
+    { return total.connections ? bytes / total.connections : 0; };
+    diag.log(diag_level_t::info,
+             "memory connections=%zu contexts=%zu context_bytes=%zu session_bytes=%zu session_pooled_bytes=%zu "
+             "buffers=%zu buffer_size=%zu buffers_peak=%zu rss_kib=%zu tracked_per_connection=%zu rss_per_connection=%zu "
+             "spilled_blocks=%zu",
+             total.connections, total.contexts, total.context_bytes, frame_pool.used(), frame_pool.pooled(),
+             buffer_pool.allocated(), buffer_pool_t::buf_size, buffer_pool.peak(), rss / 1024,
+             per_connection(tracked), per_connection(rss), total.spilled_blocks);
+    if (server.intern)
+        diag.log(diag_level_t::info, "interning entries=%zu bytes=%zu hits=%llu misses=%llu evictions=%llu",
+                 interned.entries, interned.bytes, (unsigned long long)interned.hits,
+                 (unsigned long long)interned.misses, (unsigned long long)interned.evictions);
+}
+
+/**
+ * @brief A coro to report memory every 'mem_stats_s' seconds
+ * @param context asio io_context
+ * @return nothing
  */
-void clean_directory()
+asio::awaitable<void> run_memory_reports(asio::io_context &context)
 {
-    // Clear log directory and console
-    using namespace std::filesystem;
-    auto res = system("clear");
-    (void)res;
+    asio::steady_timer timer(context);
+    while (true)
+    {
+        timer.expires_after(std::chrono::seconds(server.mem_stats_s));
+        co_await timer.async_wait(asio::use_awaitable);
+        report_memory();
+    }
+}
 
-    if (!exists(edit::log_directory))
+/**
+ * @brief A coro to report fairness metrics of every listener's output queue every 'fair_stats_s' seconds
+ * @param context asio io_context
+ * @return nothing
+ */
+asio::awaitable<void> run_fairness_reports(asio::io_context &context)
+{
+    asio::steady_timer timer(context);
+    while (true)
+    {
+        timer.expires_after(std::chrono::seconds(server.fair_stats_s));
+        co_await timer.async_wait(asio::use_awaitable);
+        for (auto &listener : server.listeners)
+        {
+            auto stats = listener.instance->fairness();
+            diag.log(diag_level_t::info,
+                     "fairness listener=%s flows=%zu queued_blocks=%zu queued_bytes=%zu dispatched=%zu spilled=%zu "
+                     "jain_index=%.3f static_wait_us=%.1f/%.1f dynamic_wait_us=%.1f/%.1f",
+                     listener.name().c_str(), stats.flows, stats.queued_blocks, stats.queued_bytes, stats.dispatched,
+                     stats.spilled, stats.jain_index, stats.static_mean_wait_us, stats.static_max_wait_us,
+                     stats.dynamic_mean_wait_us, stats.dynamic_max_wait_us);
+        }
+    }
+}
+
+/**
+ * @brief Runs the io loop; in low-latency mode the io thread polls for ready handlers
+ *        and blocks in epoll only after 'spin_us' with nothing to do
+ * @param context asio io_context
+ */
+void run_io(asio::io_context &context)
+{
+    if (!server.low_latency)
     {
-        auto res = create_directory(edit::log_directory);
-        assert(res);
+        context.run();
+        return;
     }
+    const auto spin = std::chrono::microseconds(server.spin_us);
+    while (!context.stopped())
+    {
+        auto deadline = std::chrono::steady_clock::now() + spin;
+        while (!context.stopped() && std::chrono::steady_clock::now() < deadline)
+            if (context.poll())
+                deadline = std::chrono::steady_clock::now() + spin;
+        if (!context.run_one())
+            break;
+    }
+}
 
-    const std::filesystem::directory_iterator _end;
-    for (std::filesystem::directory_iterator it(edit::log_directory); it != _end; ++it)
-        std::filesystem::remove(it->path());
+/**
+ * @brief Creates a library instance for every listener;
+ *        several listeners output into their own 'log/<port>' directories
+ * @param server server parameters structure
+ */
+void create_instances(server_t &server)
+{
+    for (auto &listener : server.listeners)
+    {
+        listener.log_dir = edit::log_directory;
+        if (server.listeners.size() > 1)
+        {
+            listener.log_dir += "/" + listener.name();
+            std::filesystem::create_directory(listener.log_dir);
+        }
+        edit::options_t options;
+        options.block_size = listener.block_size;
+        options.log_dir = listener.log_dir.c_str();
+        options.file_format = server.block_store ? edit::file_format_t::block_store : edit::file_format_t::per_block;
+        options.shards = server.shards;
+        options.console = server.console;
+        options.file = server.file;
+        options.forwarder = server.forwarder;
+        options.spin_us = server.low_latency ? server.spin_us : 0;
+        options.fair = server.fair;
+        options.intern = server.intern;
+        options.dynamic_cap = server.dynamic_cap;
+        options.inline_output = server.inline_output;
+        if (!server.forward.empty())
+            options.forward = server.forward.c_str();
+        if (!server.journal.empty())
+        {
+            listener.journal = server.journal;
+            if (server.listeners.size() > 1)
+                listener.journal += "." + listener.name();
+            options.journal = listener.journal.c_str();
+            options.journal_interval_ms = server.journal_interval_ms;
+            options.journal_bytes = server.journal_bytes;
+            options.journal_compact = server.journal_compact;
+        }
+        listener.instance = std::make_unique<edit::instance_t>(options);
+        if (!server.capture.empty())
+        {
+            listener.capture = std::make_unique<capture_writer_t>();
+            auto path = server.capture + (server.listeners.size() > 1 ? "." + listener.name() : "");
+            if (!listener.capture->open(path, listener.block_size))
+            {
+                diag.log(diag_level_t::fatal, "capture_open_error path=%s", path.c_str());
+                std::quick_exit(2);
+            }
+        }
+    }
 }
 
 /**
@@ -151,14 +705,51 @@ void clean_directory()
 int main(int argc, char **argv)
 {
 
-    clean_directory();
     if (!get_params(argc, argv, server))
         return 0;
+    if (!diag.start(server.log_path, server.log_level, server.log_rate))
+        diag.log(diag_level_t::warn, "log_open_error path=%s", server.log_path.c_str());
+    clean_directory(server.retention);
+    create_instances(server);
 
-    std::cout << "running at " + server.ip_addr << ":" << server.port << "; block size = " << server.block_size << "\n";
+    // Start server coros
+    for (auto &listener : server.listeners)
+        switch (listener.kind)
+        {
+        case listener_t::Tcp:
+            diag.log(diag_level_t::info, "running tcp=%s:%u block_size=%zu", listener.ip_addr.c_str(), unsigned(listener.port), listener.block_size);
+            asio::co_spawn(context, run_server<tcp_t>(context, listener, tcp_t::endpoint{asio::ip::make_address_v4(listener.ip_addr), listener.port}), asio::detached);
+            break;
+        case listener_t::Unix:
+            diag.log(diag_level_t::info, "running unix=%s block_size=%zu", listener.ip_addr.c_str(), listener.block_size);
+            ::unlink(listener.ip_addr.c_str()); // a stale socket file of a previous run
+            asio::co_spawn(context, run_server<unix_t>(context, listener, unix_t::endpoint{listener.ip_addr}), asio::detached);
+            break;
+        case listener_t::Udp:
+            diag.log(diag_level_t::info, "running udp=%s:%u block_size=%zu", listener.ip_addr.c_str(), unsigned(listener.port), listener.block_size);
+            asio::co_spawn(context, run_udp_server(context, listener), asio::detached);
+            break;
+        case listener_t::Shm:
+            diag.log(diag_level_t::info, "running shm=%s block_size=%zu", listener.ip_addr.c_str(), listener.block_size);
+            ::unlink(listener.ip_addr.c_str());
+            asio::co_spawn(context, run_shm_server(context, listener), asio::detached);
+            break;
+        }
 
-    // Start server coro
-    asio::co_spawn(context, run_server(context, server), asio::detached);
+    if (server.scale)
+    {
+        // A descriptor per connection: raise the soft limit as far as allowed
+        rlimit files;
+        if (!getrlimit(RLIMIT_NOFILE, &files))
+        {
+            files.rlim_cur = files.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &files);
+        }
+    }
+    if (server.mem_stats_s)
+        asio::co_spawn(context, run_memory_reports(context), asio::detached);
+    if (server.fair_stats_s && server.fair.enabled)
+        asio::co_spawn(context, run_fairness_reports(context), asio::detached);
 
     // Establish CTRL-C handler
     struct sigaction handler;
@@ -168,8 +759,18 @@ int main(int argc, char **argv)
     sigaction(SIGINT, &handler, NULL);
 
     // Starts coro loop
-    context.run();
+    run_io(context);
+    if (server.mem_stats_s)
+        report_memory();
 
     // Accurately terminates server
-    edit::terminate();
+    for (auto &listener : server.listeners)
+    {
+        listener.instance->terminate();
+        if (listener.capture)
+            listener.capture->close();
+        if (listener.kind == listener_t::Unix || listener.kind == listener_t::Shm)
+            ::unlink(listener.ip_addr.c_str());
+    }
+    diag.stop();
 }
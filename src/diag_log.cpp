@@ -0,0 +1,244 @@
+/**
+ * @brief diag_log.cpp Contains realization of 'bulk_server' diagnostics logger
+ */
+#include "diag_log.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @brief Level names, as they are written
+ */
+static const char *level_names[] = {"debug", "info", "warn", "error", "fatal"};
+
+/**
+ * @brief Parses a level name
+ * @param name debug, info, warn or error
+ * @param level parsed level
+ * @return false on unknown name
+ */
+bool parse_diag_level(const std::string &name, diag_level_t &level)
+{
+    for (int i = 0; i <= static_cast<int>(diag_level_t::error); ++i)
+        if (name == level_names[i])
+        {
+            level = static_cast<diag_level_t>(i);
+            return true;
+        }
+    return false;
+}
+
+/**
+ * @brief Writes all the bytes to a descriptor; diagnostics have nowhere to report their own errors
+ */
+static void write_all(int fd, const std::string &s)
+{
+    for (size_t written = 0; written < s.size();)
+    {
+        auto n = ::write(fd, s.data() + written, s.size() - written);
+        if (n <= 0)
+            return;
+        written += n;
+    }
+}
+
+/**
+ * @brief Appends a record as a line: '<local time> <level> t<thread> <text>'
+ */
+static void format_record(const diag_record_t &r, std::string &out)
+{
+    std::time_t secs = r.wall_ns / 1000000000;
+    std::tm tm{};
+    localtime_r(&secs, &tm);
+    char stamp[64];
+    auto n = std::strftime(stamp, sizeof(stamp), "%FT%T", &tm);
+    std::snprintf(stamp + n, sizeof(stamp) - n, ".%06u %s t%u ", unsigned(r.wall_ns % 1000000000 / 1000),
+                  level_names[static_cast<int>(r.level)], r.thread);
+    out += stamp;
+    out.append(r.text, r.length);
+    out += '\n';
+}
+
+/**
+ * @brief Opens the destination and launches the flusher; until then messages are written synchronously
+ * @param path destination file, appended to; empty - stderr
+ * @param level messages below it are skipped
+ * @param _rate max messages per second per thread, errors are not limited; 0 - unlimited
+ * @return false if the destination can't be opened
+ */
+bool diag_log_t::start(const std::string &path, diag_level_t level, unsigned _rate)
+{
+    threshold.store(level);
+    rate = _rate;
+    if (!path.empty())
+    {
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0)
+        {
+            fd = 2;
+            return false;
+        }
+    }
+    flusher = std::thread(&diag_log_t::run, this);
+    running.store(true);
+    return true;
+}
+
+/**
+ * @brief The calling thread's ring, registered on the thread's first message
+ */
+diag_buffer_t &diag_log_t::this_thread_buffer()
+{
+    thread_local diag_buffer_t *buffer = nullptr;
+    if (!buffer)
+    {
+        std::lock_guard g(registry_mtx);
+        buffers.push_back(std::make_unique<diag_buffer_t>());
+        buffer = buffers.back().get();
+        buffer->thread = buffers.size() - 1;
+    }
+    return *buffer;
+}
+
+/**
+ * @brief Formats a message into the calling thread's ring; never waits for the destination:
+ *        a message is dropped, if the ring is full, or suppressed, if the thread exceeds the rate.
+ *        A fatal message is written out before the call returns
+ * @param level message level
+ * @param format printf format of the message
+ */
+void diag_log_t::log(diag_level_t level, const char *format, ...)
+{
+    if (!enabled(level))
+        return;
+    diag_record_t record;
+    record.wall_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+    record.level = level;
+    va_list args;
+    va_start(args, format);
+    auto n = std::vsnprintf(record.text, sizeof(record.text), format, args);
+    va_end(args);
+    record.length = std::clamp(n, 0, int(sizeof(record.text)) - 1);
+
+    if (!running.load(std::memory_order_acquire)) // not started or stopped
+    {
+        record.thread = 0;
+        std::string line;
+        format_record(record, line);
+        write_all(fd, line);
+        return;
+    }
+
+    auto &buffer = this_thread_buffer();
+    record.thread = buffer.thread;
+    if (level < diag_level_t::error && rate)
+    {
+        auto window = record.wall_ns / 1000000000;
+        if (window != buffer.window)
+        {
+            buffer.window = window;
+            buffer.in_window = 0;
+        }
+        if (++buffer.in_window > rate)
+        {
+            n_suppressed.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+    if (!buffer.ring.try_push(record))
+    {
+        if (level < diag_level_t::fatal)
+        {
+            n_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        drain();
+        buffer.ring.try_push(record);
+    }
+    if (level == diag_level_t::fatal)
+        drain();
+    else if (level == diag_level_t::error)
+    {
+        urgent.store(true, std::memory_order_relaxed);
+        flusher_cv.notify_one();
+    }
+}
+
+/**
+ * @brief Writes out all the rings in time order and the counts of lost messages
+ */
+void diag_log_t::drain()
+{
+    std::lock_guard g(drain_mtx);
+    std::vector<diag_buffer_t *> rings;
+    {
+        std::lock_guard r(registry_mtx);
+        for (auto &b : buffers)
+            rings.push_back(b.get());
+    }
+    std::vector<diag_record_t> records;
+    diag_record_t record;
+    for (auto ring : rings)
+        while (ring->ring.try_pop(record))
+            records.push_back(record);
+    std::stable_sort(records.begin(), records.end(), [](const diag_record_t &a, const diag_record_t &b)
+                     { return a.wall_ns < b.wall_ns; });
+
+    std::string out;
+    for (auto &r : records)
+        format_record(r, out);
+    auto dropped = n_dropped.exchange(0);
+    auto suppressed = n_suppressed.exchange(0);
+    if (dropped || suppressed)
+        out += "diag: " + std::to_string(dropped) + " messages dropped, " + std::to_string(suppressed) + " suppressed by rate limit\n";
+    write_all(fd, out);
+}
+
+/**
+ * @brief The flusher thread: writes the rings out periodically, at once on errors
+ */
+void diag_log_t::run()
+{
+    while (true)
+    {
+        bool stop;
+        {
+            std::unique_lock lock(flusher_mtx);
+            flusher_cv.wait_for(lock, std::chrono::milliseconds(50), [this]()
+                                { return urgent.load(std::memory_order_relaxed) || stopping; });
+            stop = stopping;
+            urgent.store(false, std::memory_order_relaxed);
+        }
+        drain();
+        if (stop)
+            return;
+    }
+}
+
+/**
+ * @brief Writes out the rest of messages and joins the flusher; later messages are written synchronously
+ */
+void diag_log_t::stop()
+{
+    if (!flusher.joinable())
+        return;
+    {
+        std::lock_guard g(flusher_mtx);
+        stopping = true;
+    }
+    flusher_cv.notify_one();
+    flusher.join();
+    running.store(false);
+    drain(); // messages pushed while flusher was exiting
+    if (fd != 2)
+    {
+        ::close(fd);
+        fd = 2;
+    }
+}
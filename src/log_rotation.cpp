@@ -0,0 +1,120 @@
+/**
+ * @brief log_rotation.cpp Contains realization of log directory rotation
+ *        and background retention for 'bulk_server'
+ */
+#include "log_rotation.h"
+#include "diag_log.h"
+#include <algorithm>
+#include <chrono>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <utility>
+#ifdef __linux__
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+/**
+ * @brief Atomically renames a non-empty log directory away and creates an empty one instead
+ * @param log_dir log directory path
+ * @return the path the old directory was renamed to, or empty path if there was nothing to rotate
+ */
+fs::path rotate_log_directory(const std::string &log_dir)
+{
+    std::error_code ec;
+    fs::path rotated;
+    if (fs::exists(log_dir, ec) && !fs::is_empty(log_dir, ec))
+    {
+        auto stamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count();
+        rotated = log_dir + rotated_infix + std::to_string(stamp);
+        fs::rename(log_dir, rotated, ec); // one rename, regardless of the number of files inside
+        if (ec)
+        {
+            diag.log(diag_level_t::warn, "log_rotation_error dir=%s what=\"%s\"", log_dir.c_str(), ec.message().c_str());
+            rotated.clear();
+        }
+    }
+    fs::create_directory(log_dir, ec);
+    return rotated;
+}
+
+/**
+ * @brief Lowers CPU and IO priority of the calling thread
+ */
+static void lower_thread_priority()
+{
+#ifdef __linux__
+    constexpr int ioprio_class_idle = 3;
+    constexpr int ioprio_class_shift = 13;
+    constexpr int ioprio_who_process = 1;
+    auto tid = syscall(SYS_gettid);
+    (void)setpriority(PRIO_PROCESS, tid, 19);
+    (void)syscall(SYS_ioprio_set, ioprio_who_process, tid, ioprio_class_idle << ioprio_class_shift);
+#endif
+}
+
+/**
+ * @brief Calculates a directory size, stops counting when 'limit' is exceeded
+ */
+static uintmax_t directory_size(const fs::path &dir, uintmax_t limit)
+{
+    uintmax_t size = 0;
+    std::error_code ec;
+    for (fs::recursive_directory_iterator it(dir, ec), end; it != end && size <= limit; it.increment(ec))
+        if (it->is_regular_file(ec))
+            size += it->file_size(ec);
+    return size;
+}
+
+/**
+ * @brief Deletes rotated directories of the log directory beyond the retention policy;
+ *        runs the newest first, so the oldest runs are deleted
+ */
+static void apply_retention(const std::string &log_dir, retention_t policy)
+{
+    lower_thread_priority();
+
+    std::error_code ec;
+    auto dir = fs::path(log_dir).lexically_normal();
+    auto parent = dir.has_parent_path() ? dir.parent_path() : fs::path(".");
+    auto prefix = dir.filename().string() + rotated_infix;
+
+    std::vector<std::pair<unsigned long long, fs::path>> runs;
+    for (fs::directory_iterator it(parent, ec), end; it != end; it.increment(ec))
+    {
+        auto name = it->path().filename().string();
+        if (name.starts_with(prefix))
+            runs.emplace_back(std::strtoull(name.c_str() + prefix.size(), nullptr, 10), it->path());
+    }
+    std::sort(runs.begin(), runs.end(), std::greater{});
+
+    uintmax_t kept_bytes = 0;
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        bool keep = i < policy.keep_runs;
+        if (keep && policy.max_bytes)
+        {
+            kept_bytes += directory_size(runs[i].second, policy.max_bytes);
+            keep = kept_bytes <= policy.max_bytes;
+        }
+        if (!keep)
+            fs::remove_all(runs[i].second, ec);
+    }
+}
+
+/**
+ * @brief Starts a detached low-priority thread, which deletes rotated log directories
+ *        beyond the retention policy
+ * @param log_dir log directory path
+ * @param policy retention policy
+ */
+void start_retention(const std::string &log_dir, retention_t policy)
+{
+    std::thread(apply_retention, log_dir, policy).detach();
+}